@@ -0,0 +1,292 @@
+/**
+ * @File microbench.c
+ * @Brief Microbenchmarks of the row editing primitives of sheet.c
+ * Every kernel is timed over rows of several widths, at several columns and
+ * with delimiter sets of several sizes. Results are written as JSON so they
+ * can be compared over time, run by make microbench
+ * The file was written using hard tabs and intended for swiftwidth of 4 and
+ * line limit of 80
+ */
+#define SHEET_NO_MAIN
+#include "sheet.c"
+#include <time.h>
+
+// CONSTANTS
+#define BENCH_SAMPLES 101	// timed samples of every case
+#define BENCH_WARMUP 10	// samples thrown away before timing
+#define BENCH_MIN_NS 20000	// shortest sample, shorter ones are too noisy
+#define BENCH_CALIBRATE 5	// samples in a row which have to be long enough
+#define BENCH_CELL "1234.567"	// content of every cell of a benchmarked row
+#define BENCH_DELIMS ":;,|!#$%&*+/=?@^"	// delimiters, rows use the first
+
+// Row and everything kernels need to work on one of its columns
+typedef struct bench_case
+{
+	char row[MAX_ROW];	// row the kernel works on
+	char pristine[MAX_ROW];	// copy restoring row after a mutating kernel
+	char line[MAX_ROW];	// where load_line stores the loaded row
+	int len;	// length of row including its newline
+	int no_cols;	// amount of columns of row
+	char delim[sizeof(BENCH_DELIMS)];	// delimiter set
+	int col;	// column the kernel works on
+	int start;	// index of the first char of col
+	int end;	// index of the last char of col
+	reader_t reader;	// block of copies of row for load_line
+} bench_case_t;
+
+typedef struct kernel
+{
+	char *name;
+	int mutates;	// 1 if row has to be restored before every op
+	void (*run)(bench_case_t *c);
+} kernel_t;
+
+// Results are stored here so the kernels are not optimized out
+volatile int sink;
+
+void k_find_column_start(bench_case_t *c)
+{
+	sink = find_column_start(c->row, c->delim, c->col);
+}
+
+void k_find_column_end(bench_case_t *c)
+{
+	sink = find_column_end(c->row, c->delim, c->start, 1);
+}
+
+void k_replace_column(bench_case_t *c)
+{
+	// Longer than the cell so the rest of row is shifted
+	sink = replace_column(c->row, c->start, c->end, "98765.4321");
+}
+
+void k_row_shift_right(bench_case_t *c)
+{
+	sink = row_shift_right(c->row, c->start, 1);
+}
+
+void k_row_shift_left(bench_case_t *c)
+{
+	row_shift_left(c->row, c->start, 0);
+	sink = c->row[c->start];
+}
+
+void k_get_no_cols(bench_case_t *c)
+{
+	sink = get_no_cols(c->row, c->delim);
+}
+
+void k_load_line(bench_case_t *c)
+{
+	// Start over the block instead of reading more of it
+	if (c->reader.pos >= c->reader.len)
+		c->reader.pos = 0;
+	sink = load_line(&c->reader, c->line);
+}
+
+void k_contains_f(bench_case_t *c)
+{
+	sink = contains_f(c->row, c->col, "zz", c->delim, NULL);
+}
+
+void k_rounding_f(bench_case_t *c)
+{
+	sink = rounding_f(c->row, c->col, c->delim, ROUND);
+}
+
+const kernel_t kernels[] = {
+	{"find_column_start", 0, k_find_column_start},
+	{"find_column_end", 0, k_find_column_end},
+	{"replace_column", 1, k_replace_column},
+	{"row_shift_right", 1, k_row_shift_right},
+	{"row_shift_left", 1, k_row_shift_left},
+	{"get_no_cols", 0, k_get_no_cols},
+	{"load_line", 0, k_load_line},
+	{"contains_f", 0, k_contains_f},
+	{"rounding_f", 1, k_rounding_f}
+};
+
+/**
+ * Prepare a row of about width chars with no_delims delimiters in the set
+ * @param bench_case_t *c - case to prepare
+ * @param int width - wanted length of the row
+ * @param int no_delims - size of the delimiter set
+ */
+void bench_row(bench_case_t *c, int width, int no_delims)
+{
+	program_t program;
+	int cell = strlen(BENCH_CELL) + 1, copies;
+	c->no_cols = width / cell > 0 ? width / cell : 1;
+	c->len = 0;
+	for (int i = 0; i < c->no_cols; i++)
+	{
+		memcpy(c->row + c->len, BENCH_CELL, cell - 1);
+		c->len += cell;
+		c->row[c->len - 1] = BENCH_DELIMS[0];
+	}
+	c->row[c->len - 1] = '\n';
+	c->row[c->len] = '\0';
+	memcpy(c->pristine, c->row, c->len + 1);
+	memcpy(c->delim, BENCH_DELIMS, no_delims);
+	c->delim[no_delims] = '\0';
+
+	memset(&program, 0, sizeof(program));
+	program.delim = c->delim;
+	reader_init(&c->reader, NULL, &program);
+	copies = READ_BLOCK / c->len;
+	for (int i = 0; i < copies; i++)
+		memcpy(c->reader.buf + i * c->len, c->row, c->len);
+	c->reader.len = copies * c->len;
+}
+
+/**
+ * Return nanoseconds passed from t0 to t1
+ */
+double bench_ns(struct timespec *t0, struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) * 1e9 + (t1->tv_nsec - t0->tv_nsec);
+}
+
+/**
+ * Time ops runs of kernel, restoring the row before every run of
+ * a mutating kernel
+ * @param const kernel_t *k - kernel to time
+ * @param bench_case_t *c - case to run it on
+ * @param long ops - amount of runs
+ * @param int restore_only - 1 to time just the restoring
+ * @return double - nanoseconds per run
+ */
+double bench_sample(const kernel_t *k, bench_case_t *c, long ops,
+		int restore_only)
+{
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (long i = 0; i < ops; i++)
+	{
+		if (k->mutates)
+			memcpy(c->row, c->pristine, c->len + 1);
+		if (!restore_only)
+			k->run(c);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return bench_ns(&t0, &t1) / ops;
+}
+
+int bench_cmp(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Take BENCH_SAMPLES sorted samples of the kernel after warming it up, runs
+ * in a sample are doubled until BENCH_CALIBRATE warm samples in a row and
+ * the median sample take at least BENCH_MIN_NS
+ * @param const kernel_t *k - kernel to time
+ * @param bench_case_t *c - case to run it on
+ * @param int restore_only - 1 to time just the restoring
+ * @param double *samples - array of BENCH_SAMPLES to fill
+ * @return long - amount of runs in a sample
+ */
+long bench_measure(const kernel_t *k, bench_case_t *c, int restore_only,
+		double *samples)
+{
+	long ops = 1;
+	// Only a rough guess, the first samples are cold
+	while (bench_sample(k, c, ops, restore_only) * ops < BENCH_MIN_NS)
+		ops *= 2;
+	for (int i = 0; i < BENCH_WARMUP; i++)
+		bench_sample(k, c, ops, restore_only);
+	for (;;)
+	{
+		for (int long_enough = 0; long_enough < BENCH_CALIBRATE;)
+		{
+			if (bench_sample(k, c, ops, restore_only) * ops >= BENCH_MIN_NS)
+				long_enough++;
+			else
+			{
+				ops *= 2;
+				long_enough = 0;
+			}
+		}
+		for (int i = 0; i < BENCH_SAMPLES; i++)
+			samples[i] = bench_sample(k, c, ops, restore_only);
+		qsort(samples, BENCH_SAMPLES, sizeof(double), bench_cmp);
+		if (samples[BENCH_SAMPLES / 2] * ops >= BENCH_MIN_NS)
+			return ops;
+		// Samples got faster than the calibration, take them again
+		ops *= 2;
+	}
+}
+
+/**
+ * Run every kernel over every case and write the results as JSON
+ * @param FILE *out - where to write the results
+ */
+void bench_all(FILE *out)
+{
+	static bench_case_t c;
+	const int widths[] = { 64, 512, 4096 }, delim_sizes[] = { 1, 4, 16 };
+	const int n_kernels = sizeof(kernels) / sizeof(kernels[0]);
+	double samples[BENCH_SAMPLES], restore[BENCH_SAMPLES];
+	int first = 1;
+
+	fprintf(out, "{\n\t\"timer\": \"clock_gettime(CLOCK_MONOTONIC)\",\n"
+			"\t\"samples\": %d,\n\t\"results\": [", BENCH_SAMPLES);
+	for (int w = 0; w < 3; w++)
+		for (int d = 0; d < 3; d++)
+			for (int position = 0; position < 3; position++)
+				for (int k = 0; k < n_kernels; k++)
+				{
+					bench_row(&c, widths[w], delim_sizes[d]);
+					// First, middle and last column
+					c.col = position == 0 ? 1 : position == 1 ?
+						(c.no_cols + 1) / 2 : c.no_cols;
+					c.start = find_column_start(c.row, c.delim, c.col);
+					c.end = find_column_end(c.row, c.delim, c.start, 1);
+
+					long ops = bench_measure(&kernels[k], &c, 0, samples);
+					double base = 0;
+					if (kernels[k].mutates)
+					{
+						// Restoring the row is not a part of the kernel
+						bench_measure(&kernels[k], &c, 1, restore);
+						base = restore[BENCH_SAMPLES / 2];
+					}
+					double median = samples[BENCH_SAMPLES / 2] - base;
+					double p99 = samples[BENCH_SAMPLES * 99 / 100] - base;
+					median = median > 0 ? median : 0;
+					p99 = p99 > 0 ? p99 : 0;
+					fprintf(out, "%s\n\t\t{\"kernel\": \"%s\", "
+							"\"row_bytes\": %d, \"columns\": %d, "
+							"\"column\": %d, \"delims\": %d, "
+							"\"ops_per_sample\": %ld, "
+							"\"ns_per_op_median\": %.2f, "
+							"\"ns_per_op_p99\": %.2f, "
+							"\"bytes_per_ns\": %.3f}", first ? "" : ",",
+							kernels[k].name, c.len, c.no_cols, c.col,
+							delim_sizes[d], ops, median, p99,
+							median > 0 ? c.len / median : 0);
+					first = 0;
+				}
+	fprintf(out, "\n\t]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+	FILE *out = stdout;
+	if (argc > 2)
+	{
+		fprintf(stderr, "Usage: microbench [FILE]\n");
+		return EXIT_FAILURE;
+	}
+	if (argc == 2 && !(out = open_file(argv[1], "w")))
+		return EXIT_FAILURE;
+	bench_all(out);
+	if (out != stdout && fclose(out) == EOF)
+	{
+		fprintf(stderr, "Cannot write file %s!\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
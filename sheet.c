@@ -7,12 +7,23 @@
  * The file was written using hard tabs and intended for swiftwidth of 4 and
  * line limit of 80
  */
+#define _GNU_SOURCE	// fopencookie, along with POSIX fileno, stat, nanosleep
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "sheet.h"
 
 // CONSTANTS
-#define NO_COMMANDS 18
+#define NO_COMMANDS 25
 #define LENGTH_NAME 11
 #define MAX_CELL 100
 #define MAX_ROW 10240	// 10KiB in ASCII
@@ -21,19 +32,53 @@
 #define NO_CONVERSION 0
 #define EMPTY_COL -2
 #define MOD_START 0	// First index of mod commands
-#define MOD_END 7	// Last index of mod commands
-#define DATA_START 8	// First index of data commands
-#define DATA_END 15	// Last index of data commands
-#define SELECTION_START 16	// First index of selection commands
-#define SELECTION_END 18	// Last index of selection commands
+#define MOD_END 8	// Last index of mod commands
+#define DATA_START 9	// First index of data commands
+#define DATA_END 19	// Last index of data commands
+#define SELECTION_START 20	// First index of selection commands
+#define SELECTION_END 25	// Last index of selection commands
 #define TOO_LONG -1
 #define NOT_FOUND -1
+#define READ_BLOCK 65536	// 64KiB of input is read at once
+#define WRITE_BLOCK 65536	// 64KiB of output is written at once
+#define JOIN_NONE 0	// selection term starts a new selection
+#define JOIN_AND 1	// selection term is joined to the previous one by and
+#define JOIN_OR 2	// selection term is joined to the previous one by or
+#define ADAPT_ROWS 1000	// rows after which selection terms are reordered
+#define SCHEMA_ROWS 1000	// rows sampled before --adaptive picks fast paths
+#define FAST_NONE 0	// command takes the generic path
+#define FAST_INT 1	// round and int keep cells which are already integers
+#define CACHE_SLOTS 64	// cells remembered by a cell cache
+#define CACHE_PROBE 1024	// lookups after which the cache hit rate is checked
+#define CHECKPOINT_ROWS 100000	// rows between two checkpoints
+#define PARTITION_SLOTS 4096	// initial size of the hash table of partitions
+#define PARTITION_NAME 256	// longest file name of a partition, with '\0'
+#define PARTITION_OPEN 64	// most partition files open at once
+#define PARTITION_BLOCK 8192	// output buffer of a single partition file
+#define INNER_JOIN 0	// rows without a match in the joined table are deleted
+#define LEFT_JOIN 1	// rows without a match get empty columns
+#define JOIN_SLOTS 1024	// initial size of the hash table of a joined table
+#define JOIN_MEMORY 67108864	// 64MiB, larger joined tables stay on disk
+#define ORDER_NUM 0	// top compares the key column as numbers
+#define ORDER_STR 1	// top compares the key column as strings
+#define ORDER_DESC 0	// top keeps the largest rows
+#define ORDER_ASC 1	// top keeps the smallest rows
+#define MAX_FIXED 256	// most columns of a fixed width row
+#define FOLLOW_POLL 1000000	// 1ms, wait for a followed file to grow
+#define GZ_BLOCK 65536	// 64KiB of a .gz file is handed over at once
+#define GZ_LEVEL 6	// compression level of .gz files without --level
+#define SERVE_CACHE 64	// compiled programs kept by a server
+#define SERVE_BLOCK 65536	// 64KiB of a request or a response read at once
+#define SERVE_ERROR 4096	// longest error messages sent to a client
 
 // MACROS
 #define IS_MOD(CMD_NUM) (CMD_NUM >= MOD_START && CMD_NUM <= MOD_END)
 #define IS_DATA(CMD_NUM) (CMD_NUM >= DATA_START && CMD_NUM <= DATA_END)
 #define IS_SELECTION(CMD_NUM) (CMD_NUM >= SELECTION_START &&\
 		CMD_NUM <= SELECTION_END)
+// Commands which decide which rows are written, always the last command
+#define IS_FINAL(CMD_NUM) (CMD_NUM == TOP || CMD_NUM == SAMPLE ||\
+		CMD_NUM == EVERY)
 #define ABS(num) (num < 0 ? -(num) : num)
 
 struct command_t
@@ -42,11 +87,29 @@ struct command_t
 	int no_args;
 } const commands_s[] = {
 	{"irow", 1},	{"arow", 0},	{"drow", 1},	{"drows", 2},	{"icol", 1},
-	{"acol", 0},	{"dcol", 1},	{"dcols", 2},	{"cset", 2},	{"tolower", 1},
-	{"toupper", 1},	{"round", 1},	{"int", 1},	{"copy", 2},	{"swap", 2},
-	{"move", 2},	{"rows", 2},	{"beginswith", 2},	{"contains", 2}
+	{"acol", 0},	{"dcol", 1},	{"dcols", 2},	{"join", 3},	{"cset", 2},
+	{"tolower", 1},	{"toupper", 1},	{"round", 1},	{"int", 1},	{"copy", 2},
+	{"swap", 2},	{"move", 2},	{"top", 2},	{"sample", 1},
+	{"every", 1},	{"rows", 2},	{"beginswith", 2},	{"contains", 2},
+	{"and", 0},	{"or", 0},	{"not", 0}
 };
 
+// Rows of the table given to join, looked up by the value of a key column
+typedef struct join_table
+{
+	char *arena;	// entries one after another, key followed by its row
+	long used;	// amount of chars of arena in use
+	long size;	// allocated size of arena
+	long *slots;	// hash table of offsets of entries, NOT_FOUND if empty
+	long n_slots;	// length of slots, always a power of 2
+	long n_rows;	// amount of entries
+	int no_cols;	// amount of columns added to a row, key is not added
+	int key_col;	// number of the key column
+	// Table larger than JOIN_MEMORY, entries hold offsets of rows in file
+	// instead of the rows, every pipeline opens the file on its own
+	char *path;
+} join_table_t;
+
 typedef struct user_args
 {
 	int cmd_num;
@@ -54,6 +117,9 @@ typedef struct user_args
 	char str_arg[MAX_CELL];
 	int dash1;	// if first arg to rows is -
 	int dash2;	// if second arg to rows is -
+	int negate;	// if selection term is preceded by odd amount of not
+	int join;	// how selection term is joined to the previous one
+	join_table_t *table;	// loaded table if command is join, NULL otherwise
 } user_args_t;
 
 typedef struct cmd_types
@@ -63,12 +129,218 @@ typedef struct cmd_types
 	int selection;	// How many selection commands were called
 } cmd_types_t;
 
+// Commands parsed from the command line, once loaded it is never modified so
+// a single program can be run over any number of tables, even concurrently
+typedef struct program
+{
+	user_args_t *user_args;	// array of called commands
+	int arg_no;	// length of user_args array
+	cmd_types_t cmd_types;	// ammount and types of called commands
+	char *delim;	// string of delim characters
+	char **inputs;	// files to read given by -i, NULL terminated
+	char **outputs;	// files to write given by -o, NULL terminated
+	char **chain;	// files read after the first one as a single table
+	int follow;	// 1 if every row is written as soon as it is processed
+	char *checkpoint;	// file to store progress in, NULL if disabled
+	int resume;	// 1 if to continue from the stored checkpoint
+	unsigned hash;	// hash of the commands, guards resuming other commands
+	int partition_by;	// column splitting rows into files, 0 if disabled
+	char *out_dir;	// directory of the partition files
+	struct program *then;	// program run over the same read, NULL if none
+	char *then_output;	// file to write to, NULL if the first program
+	int shard;	// which of shards parts of the input to read, from 1
+	int shards;	// amount of equal parts of the input, 0 if not sharding
+	long range_start;	// first byte of the input to read rows from
+	long range_end;	// byte past the range to read, 0 if not limited
+	long first_row;	// number of the first row of the range, 0 to count
+	int merge;	// 1 if outputs of shards are to be merged
+	char *fixed_input;	// widths of columns of input, NULL if delimited
+	char *fixed_output;	// widths of columns of output, NULL if delimited
+	int adaptive;	// 1 if fast paths are picked by traits of sampled cells
+	int level;	// compression level of written .gz files
+} program_t;
+
+typedef struct reader
+{
+	FILE *in;	// stream to read from
+	char **files;	// files to read once in is exhausted, NULL terminated
+	int own_in;	// 1 if in was opened from files and has to be closed
+	int error;	// 1 if one of files could not be opened
+	int follow;	// 1 if lines are processed as soon as they arrive
+	char *path;	// file followed after its end, NULL if a stream or no follow
+	char buf[READ_BLOCK];	// block of input read at once
+	int pos;	// index of the first unread char in buf
+	int len;	// amount of valid chars in buf
+	char delim_map[UCHAR_MAX + 1];	// 1 for every char that is a delimiter
+	char delim;	// delimiter all the other delimiters are replaced with
+	int no_cols;	// number of columns of the last loaded line
+	long base;	// offset of buf[0] in the input
+	long end;	// rows starting at this offset or later are not read
+	char last;	// last char of the previous block
+	int widths[MAX_FIXED];	// widths of fixed width columns
+	int n_widths;	// amount of fixed width columns, 0 if delimited
+} reader_t;
+
+// Offsets of all columns of a row found by a single scan, commands reuse them
+// until a command changes the row
+typedef struct columns
+{
+	int start[MAX_ROW + 1];	// index of the first char of every column
+	int count;	// amount of columns, 0 if the row was not scanned yet
+} columns_t;
+
+// File with all the rows sharing a value in the partition column
+typedef struct partition
+{
+	char name[PARTITION_NAME];	// file name of the value, empty if unused
+	FILE *file;	// open file, NULL while closed
+	// Neighbours in the list of open files, most recently used first
+	struct partition *prev;
+	struct partition *next;
+} partition_t;
+
+// Destination of the processed rows, either a single stream or files in
+// a directory chosen by the value of a column
+typedef struct writer
+{
+	FILE *out;	// stream to write to when not partitioning
+	char *delim;	// string of delim characters
+	int column;	// column to partition by, 0 if not partitioning
+	char *dir;	// directory of the partition files
+	partition_t *parts;	// hash table of partitions
+	long n_slots;	// length of parts, always a power of 2
+	long n_parts;	// amount of partitions in parts
+	int n_open;	// amount of open partition files
+	partition_t *head;	// most recently used open partition
+	partition_t *tail;	// least recently used open partition
+	int widths[MAX_FIXED];	// widths of fixed width columns
+	int n_widths;	// amount of fixed width columns, 0 if delimited
+} writer_t;
+
 enum commands
 {
-	IROW, AROW, DROW, DROWS, ICOL, ACOL, DCOL, DCOLS, CSET, TOLOWER, TOUPPER,
-	ROUND, INT, COPY, SWAP, MOVE, ROWS, BEGINSWITH, CONTAINS
+	IROW, AROW, DROW, DROWS, ICOL, ACOL, DCOL, DCOLS, JOIN, CSET, TOLOWER,
+	TOUPPER, ROUND, INT, COPY, SWAP, MOVE, TOP, SAMPLE, EVERY, ROWS, BEGINSWITH,
+	CONTAINS, AND, OR, NOT
 };
 
+// Terms of a selection joined by and, stored in order of evaluation
+typedef struct clause
+{
+	int first;	// index into the order array of the first term
+	int length;	// amount of terms in the clause
+	int last;	// 1 if it is the last clause of its selection
+} clause_t;
+
+// Runtime state of all selections of a program for a single table
+typedef struct selection_plan
+{
+	int *order;	// indexes of selection terms, clause by clause
+	clause_t *clauses;	// clauses of all selections
+	int *first_clause;	// first clause of selection starting at index
+	int *end;	// last command of selection starting at index
+	long *tested;	// how many times was term at index evaluated
+	long *passed;	// how many times did term at index select the row
+	int n_clauses;	// length of clauses array
+} selection_plan_t;
+
+// Results of round or int for recently seen cells, so columns with few
+// distinct values are only parsed and formatted once per value
+typedef struct cell_cache
+{
+	char in[CACHE_SLOTS][MAX_CELL];	// cells before the command
+	char out[CACHE_SLOTS][MAX_CELL];	// cells after the command
+	int used[CACHE_SLOTS];	// 1 if the slot holds a cell
+	int lookups;	// lookups since the hit rate was checked
+	int hits;	// hits since the hit rate was checked
+	int disabled;	// 1 once the hit rate was too low to be worth it
+} cell_cache_t;
+
+// Row kept by top
+typedef struct top_entry
+{
+	char *row;	// copy of the row
+	int len;	// length of row
+	int size;	// allocated size of row
+	int key;	// index of the first char of the key column in row
+	int key_len;	// length of the key column
+	double num;	// value of the key column when compared as numbers
+	long seq;	// number of the row, of equal rows the earlier one wins
+} top_entry_t;
+
+// Best rows seen so far, in a binary heap with the worst one on top
+typedef struct top
+{
+	top_entry_t *heap;	// kept rows, NULL if the program has no top
+	int n;	// amount of kept rows
+	int k;	// most rows to keep
+	int col;	// number of the key column
+	int type;	// ORDER_NUM or ORDER_STR
+	int order;	// ORDER_DESC or ORDER_ASC
+} top_t;
+
+// Rows taken by sample or every
+typedef struct sampler
+{
+	top_entry_t *rows;	// reservoir of sample, NULL for every
+	long k;	// size of the reservoir or the stride of every
+	long n;	// amount of rows in the reservoir
+	long seen;	// amount of rows which got to the command
+	long next;	// value of seen of the next row to take
+	double w;	// weight of Algorithm L of the reservoir
+	unsigned long long state;	// state of the random generator
+	int active;	// 1 if the program ends with sample or every
+} sampler_t;
+
+// What the cells a command got while sampling had in common
+typedef struct column_traits
+{
+	int integer;	// 1 while every cell was empty or an integer, see int_cell
+	int fast;	// FAST_* path picked once the sampling is over
+} column_traits_t;
+
+// State of a single program running over a table, rows are fed to it one by
+// one, so more programs can share a single read of the input
+typedef struct pipeline
+{
+	const program_t *program;	// commands to call
+	writer_t writer;	// where to write the result to
+	char row[MAX_ROW];	// own copy of a shared row, made once it changes
+	int no_cols_adjusted;	// number of columns after mod commands
+	int *skip;	// see selection_skips
+	selection_plan_t plan;	// order of selection terms
+	cell_cache_t *caches;	// caches of all round and int commands
+	cell_cache_t **cache_of;	// cache of command at index
+	columns_t cols;	// column offsets of row shared by the commands
+	int no_cols;	// number of columns of the table
+	int joins;	// amount of join commands
+	int mapped;	// 1 if column commands of mod are done by col_map
+	int col_map[MAX_ROW];	// see column_plan
+	int n_map;	// length of col_map
+	int *key_col;	// key column of join at index after earlier joins
+	FILE **joined;	// own stream of join at index kept on disk, or NULL
+	int *run_end;	// last command of a run of swap and move starting at index
+	int *run_map;	// map of run starting at index i starts at i * no_cols
+	top_t top;	// rows kept by top
+	sampler_t sampler;	// rows taken by sample or every
+	long seen;	// amount of rows data_row was called with
+	// Traits of cells of command at index, NULL without --adaptive
+	column_traits_t *traits;
+} pipeline_t;
+
+// Where errors of the calling thread are collected, NULL for stderr
+__thread FILE *error_stream;
+
+/**
+ * Return the stream errors of the calling thread are written to, which
+ * is stderr unless sheet_compile or sheet_run collect them
+ * @return FILE * - stream for error messages
+ */
+FILE *errs(void)
+{
+	return error_stream ? error_stream : stderr;
+}
+
 /**
  * Return 1 input is a delim 0 otherwise
  * @param char input - char from stdin
@@ -185,6 +457,98 @@ int find_column_end(char row[MAX_ROW], char *delim, int start, int skip)
 	return NOT_FOUND;
 }
 
+/**
+ * Find starts of all columns of row
+ * start[count] is set to one char past the newline, so column i always
+ * ends two chars before start[i + 1]
+ * @param char *row - row from stdin
+ * @param char *delim - delimiter by which to split columns
+ * @param columns_t *cols - where to store the offsets
+ */
+void index_columns(char *row, char *delim, columns_t *cols)
+{
+	int i;
+	cols->count = 1;
+	cols->start[0] = 0;
+	if (delim[0] && !delim[1])
+	{
+		// A single delimiter is found by memchr instead of char by char
+		char *end = row + strlen(row), *c = row;
+		char *newline = memchr(row, '\n', end - row);
+		end = newline ? newline : end;
+		while ((c = memchr(c, delim[0], end - c)))
+			cols->start[cols->count++] = ++c - row;
+		cols->start[cols->count] = end - row + 1;
+		return;
+	}
+	for (i = 0; row[i] && row[i] != '\n'; i++)
+		if (is_delim(row[i], delim))
+			cols->start[cols->count++] = i + 1;
+	cols->start[cols->count] = i + 1;
+}
+
+/**
+ * Find first and last index of column target, same as find_column_start
+ * and find_column_end but uses and fills the column offsets
+ * @param char *row - row from stdin
+ * @param char *delim - delimiter by which to split columns
+ * @param columns_t *cols - offsets of columns, NULL to scan the row
+ * @param int target - number of the column
+ * @param int *start - where to store the first index of the column
+ * @param int *end - where to store the last index, EMPTY_COL if empty
+ */
+void column_bounds(char *row, char *delim, columns_t *cols, int target,
+		int *start, int *end)
+{
+	if (cols && !cols->count)
+		index_columns(row, delim, cols);
+	if (!cols || target > cols->count)
+	{
+		*start = find_column_start(row, delim, target);
+		*end = find_column_end(row, delim, *start, 1);
+		return;
+	}
+	*start = cols->start[target - 1];
+	*end = cols->start[target] - 2;
+	if (*end < *start)
+		*end = EMPTY_COL;
+}
+
+/**
+ * Build row out of the columns of row in the order given by map
+ * @param char *row - row to take the columns from
+ * @param columns_t *cols - offsets of all columns of row
+ * @param int *map - index of the column of row for every column of the
+ * result, EMPTY_COL for an empty column
+ * @param int n_map - length of map
+ * @param char delim - delimiter to put between the columns
+ * @param char *out - where to build the result, MAX_ROW long
+ * @return int - length of the result, TOO_LONG if it does not fit MAX_ROW
+ */
+int gather_columns(char *row, columns_t *cols, int *map, int n_map,
+		char delim, char *out)
+{
+	int length = 0, end = cols->start[cols->count] - 1;
+	for (int i = 0; i < n_map; i++)
+	{
+		int col = map[i], size = 0;
+		if (col != EMPTY_COL)
+			size = cols->start[col + 1] - 1 - cols->start[col];
+		// Room for a delimiter, the newline and the terminating null
+		if (length + size + 3 > MAX_ROW)
+			return TOO_LONG;
+		if (i)
+			out[length++] = delim;
+		if (size)
+			memcpy(out + length, row + cols->start[col], size);
+		length += size;
+	}
+	if (row[end] == '\n')
+		out[length++] = '\n';
+	out[length] = '\0';
+	return length;
+}
+
 /**
  * Move all characters in row by offset to the right
  * Fill characters left by the shift with whitespaces
@@ -200,7 +564,7 @@ int row_shift_right(char row[MAX_ROW], int start, int offset)
 	start--; // To move the entire string it must terminate at start - 1
 	if (i + offset > MAX_ROW)
 	{
-		fprintf(stderr, "Line limit exceeded.\n");
+		fprintf(errs(), "Line limit exceeded.\n");
 		return 0;
 	}
 	/* Fill out the place after the string with whitespaces
@@ -343,20 +707,6 @@ void get_column_content(char *row, int col_start, int col_end, char *str,
 	}
 }
 
-void irow_f(int no_cols, char *delim)
-{
-	char temp[MAX_ROW];
-	create_empty_row(temp, no_cols, delim);
-	printf("%s", temp);
-}
-
-void arow_f(int no_cols, char *delim)
-{
-	char temp[MAX_ROW];
-	create_empty_row(temp, no_cols, delim);
-	printf("%s", temp);
-}
-
 void drow_f(char *row)
 {
 	// In most cases it could be enough to just replace the first char with null
@@ -376,7 +726,7 @@ int icol_f(char *row, int target, char *delim)
 	int start;
 	if (strlen(row) == MAX_ROW - 1)
 	{
-		fprintf(stderr, "Line limit exceeded.\n");
+		fprintf(errs(), "Line limit exceeded.\n");
 		return 0;
 	}
 	/* To insert a column we first need to find find the start of
@@ -394,7 +744,7 @@ int acol_f(char *row, char *delim)
 {
 	if (strlen(row) == MAX_ROW - 1)
 	{
-		fprintf(stderr, "Line limit exceeded.\n");
+		fprintf(errs(), "Line limit exceeded.\n");
 		return 0;
 	}
 	int length = strlen(row);
@@ -435,7 +785,7 @@ int cset_f(char *row, int target, char *str, char *delim)
 {
 	if (strlen(row) + strlen(str) >= MAX_ROW - 1)
 	{
-		fprintf(stderr, "Line limit exceeded.\n");
+		fprintf(errs(), "Line limit exceeded.\n");
 		return 0;
 	}
 	int col_start = find_column_start(row, delim, target);
@@ -446,26 +796,31 @@ int cset_f(char *row, int target, char *str, char *delim)
 }
 
 // This function handles tolower and to upper, since most of their code
-// would be similar; case_type can be NO_COVERSION, TOUPPER or TOLOWER
-void changecase_f(char *row, int target, char *delim, int case_type)
+// would be similar; case_type can be TOUPPER or TOLOWER
+void changecase_f(char *row, int target, char *delim, int case_type,
+		columns_t *cols)
 {
-	char str[MAX_CELL] = "";
-	int col_start = find_column_start(row, delim, target);
-	int col_end = find_column_end(row, delim, col_start, 1);
-	get_column_content(row, col_start, col_end, str, case_type);
-	// replace_column cannot fail here since it only changes case and does not
-	// add any additional characters
-	replace_column(row, col_start, col_end, str);
+	int col_start, col_end;
+	column_bounds(row, delim, cols, target, &col_start, &col_end);
+	// Changing case does not change the length of the column, so it is done
+	// in place instead of copying the column out and back
+	for (; col_end != EMPTY_COL && col_start <= col_end; col_start++)
+	{
+		if (case_type == TOLOWER)
+			row[col_start] = to_lower(row[col_start]);
+		else
+			row[col_start] = to_upper(row[col_start]);
+	}
 }
 
-void tolower_f(char *row, int target, char *delim)
+void tolower_f(char *row, int target, char *delim, columns_t *cols)
 {
-	changecase_f(row, target, delim, TOLOWER);
+	changecase_f(row, target, delim, TOLOWER, cols);
 }
 
-void toupper_f(char *row, int target, char *delim)
+void toupper_f(char *row, int target, char *delim, columns_t *cols)
 {
-	changecase_f(row, target, delim, TOUPPER);
+	changecase_f(row, target, delim, TOUPPER, cols);
 }
 
 // This handles int and round, since most of their code would be similar
@@ -481,7 +836,7 @@ int rounding_f(char *row, int target, char *delim, int round_type)
 		double to_round = strtod(cell, &endptr);
 		if(*endptr)
 		{
-			fprintf(stderr, "Column contains other data than numbers!\n");
+			fprintf(errs(), "Column contains other data than numbers!\n");
 			return 0;
 		}
 		if (round_type == ROUND)
@@ -505,6 +860,91 @@ int int_f(char *row, int target, char *delim)
 	return rounding_f(row, target, delim, INT);
 }
 
+/**
+ * Return 1 if the cell is empty or an integer which round and int would
+ * write back unchanged, that is without leading zeros, plus or -0 and
+ * short enough to fit into int
+ * @param char *row - row with the cell
+ * @param int target - number of the column of the cell
+ * @param char *delim - string of delim characters
+ * @param columns_t *cols - column offsets of row, NULL if not indexed
+ * @return int - 1 if the cell would not change, 0 otherwise
+ */
+int int_cell(char *row, int target, char *delim, columns_t *cols)
+{
+	int start, end;
+	column_bounds(row, delim, cols, target, &start, &end);
+	if (end == EMPTY_COL)
+		return 1;
+	char *cell = row + start;
+	int length = end - start + 1;
+	if (*cell == '-')
+	{
+		cell++;
+		length--;
+	}
+	if (length < 1 || length > 9)
+		return 0;
+	if (*cell == '0')
+		return cell == row + start && length == 1;
+	for (; length; length--, cell++)
+		if (*cell < '0' || *cell > '9')
+			return 0;
+	return 1;
+}
+
+/**
+ * Return FNV-1a hash of a string
+ * @param char *str - string to hash
+ * @return unsigned - hash of str
+ */
+unsigned cell_hash(char *str)
+{
+	unsigned hash = 2166136261u;
+	while (*str)
+		hash = (hash ^ (unsigned char) *str++) * 16777619u;
+	return hash;
+}
+
+// rounding_f with results remembered in cache, turns itself off for columns
+// where less than half of the lookups hit
+int cached_rounding_f(char *row, int target, char *delim, int round_type,
+		cell_cache_t *cache, columns_t *cols)
+{
+	char cell[MAX_CELL] = "", new_cell[MAX_CELL] = "";
+	int start, end;
+	if (cache->disabled)
+		return rounding_f(row, target, delim, round_type);
+
+	column_bounds(row, delim, cols, target, &start, &end);
+	get_column_content(row, start, end, cell, NO_CONVERSION);
+	int slot = cell_hash(cell) % CACHE_SLOTS;
+	if (cache->used[slot] && strcmp(cache->in[slot], cell) == 0)
+	{
+		cache->hits++;
+		replace_column(row, start, end, cache->out[slot]);
+	}
+	else
+	{
+		if (!rounding_f(row, target, delim, round_type))
+			return 0;
+		// Columns before target did not change, start is still valid
+		end = find_column_end(row, delim, start, 1);
+		get_column_content(row, start, end, new_cell, NO_CONVERSION);
+		strcpy(cache->in[slot], cell);
+		strcpy(cache->out[slot], new_cell);
+		cache->used[slot] = 1;
+	}
+
+	if (++cache->lookups == CACHE_PROBE)
+	{
+		if (cache->hits < CACHE_PROBE / 2)
+			cache->disabled = 1;
+		cache->lookups = cache->hits = 0;
+	}
+	return 1;
+}
+
 int copy_f(char *row, int target_from, int target_to, char *delim)
 {
 	int col_start_from = find_column_start(row, delim, target_from);
@@ -564,7 +1004,7 @@ int move_f(char *row, int target_from, int target_to, char *delim)
 /**
  * Return if rows should be selected or no
  */
-int rows_f(int n_row, int row_from, int row_to, int is_last_line, int dash1,
+int rows_f(long n_row, long row_from, long row_to, int is_last_line, int dash1,
 		int dash2)
 {
 	if (dash1 == 1)
@@ -585,15 +1025,19 @@ int rows_f(int n_row, int row_from, int row_to, int is_last_line, int dash1,
 		return 0;
 }
 
-int beginswith_f(char *row, int target, char *str, char *delim)
+// beginswith and contains compare the column right inside the row, since
+// they do not change it there is no need to copy it out
+
+int beginswith_f(char *row, int target, char *str, char *delim,
+		columns_t *cols)
 {
-	char cell[MAX_CELL];
-	int start = find_column_start(row, delim, target);
-	int end = find_column_end(row, delim, start, 1);
-	get_column_content(row, start, end, cell, NO_CONVERSION);
+	int start, end;
+	column_bounds(row, delim, cols, target, &start, &end);
+	char *cell = row + start;
+	int cell_length = end == EMPTY_COL ? 0 : end - start + 1;
 	int length = strlen(str);
 
-	if (length > (int) strlen(cell))
+	if (length > cell_length)
 			return 0;
 	for (int i = 0; i < length; i++)
 		if (cell[i] != str[i])
@@ -601,15 +1045,20 @@ int beginswith_f(char *row, int target, char *str, char *delim)
 	return 1;
 }
 
-int contains_f(char *row, int target, char *str, char *delim)
+int contains_f(char *row, int target, char *str, char *delim,
+		columns_t *cols)
 {
-	char cell[MAX_CELL];
-	int start = find_column_start(row, delim, target);
-	int end = find_column_end(row, delim, start, 1);
-	get_column_content(row, start, end, cell, NO_CONVERSION);
-	int cell_length = strlen(cell);
+	int start, end;
+	column_bounds(row, delim, cols, target, &start, &end);
+	char *cell = row + start;
+	int cell_length = end == EMPTY_COL ? 0 : end - start + 1;
 	int str_length = strlen(str);
 
+	// Neither needs the cell to be compared char by char
+	if (str_length > cell_length)
+		return 0;
+	if (str_length == 1)
+		return memchr(cell, str[0], cell_length) != NULL;
 	int matches = 0;
 	for (int i = 0; i < cell_length; i++)
 	{
@@ -634,7 +1083,7 @@ int row_arg_check(int n_row)
 {
 	if (n_row <= 0)
 	{
-		fprintf(stderr, "Invalid row number: %d!\n", n_row);
+		fprintf(errs(), "Invalid row number: %d!\n", n_row);
 		return 0;
 	}
 	return 1;
@@ -650,12 +1099,12 @@ int col_arg_check(int target, int no_cols)
 {
 	if (target <= 0)
 	{
-		fprintf(stderr, "Invalid column number: %d!\n", target);
+		fprintf(errs(), "Invalid column number: %d!\n", target);
 		return 0;
 	}
 	else if (target > no_cols)
 	{
-		fprintf(stderr, "Invalid column number: %d!\n", target);
+		fprintf(errs(), "Invalid column number: %d!\n", target);
 		return 0;
 	}
 	return 1;
@@ -671,545 +1120,4180 @@ int two_arg_check(int arg1, int arg2)
 {
 	if (arg1 > arg2)
 	{
-		fprintf(stderr, "Invalid arguments: %d !<= %d\n", arg1, arg2);
+		fprintf(errs(), "Invalid arguments: %d !<= %d\n", arg1, arg2);
 		return 0;
 	}
 	return 1;
 }
 
-/*
- * Load a line from standard input and replace all delim characters
- * @param char *row - where to store the row from stdin
- * @param char *delim - delim to find and replace
- * @return int - length of loaded row, TOO_LONG if it exceeds MAX_ROW
+/**
+ * Open file and report an error if it cannot be opened
+ * @param char *path - path of the file
+ * @param char *mode - mode for fopen
+ * @return FILE * - opened file, NULL if error encountered
  */
-int load_line(char *row, char *delim)
+FILE *open_file(char *path, char *mode)
 {
-	int i;
-	char c;
-	for(i = 0; i < MAX_ROW - 1 && (c = getchar())!= EOF; i++)
-	{
-		// replace delim if delim
-		if(is_delim(c, delim))
-			*row++ = delim[0];
-		else
-			*row++ = c;
+	FILE *file = fopen(path, mode);
+	if (!file)
+		fprintf(errs(), "Cannot open file %s!\n", path);
+	return file;
+}
 
-		// Works thanks to short circuit boolean logic in C
-		if ( i == MAX_ROW - 2 && getchar() != EOF)
-			return TOO_LONG;
+// A .gz file compressed or decompressed by a thread of its own, while the
+// commands read or write it through a FILE made by fopencookie. The two
+// blocks are taken in turns, one is filled while the other is drained
+typedef struct gz_stream
+{
+	gzFile gz;	// the compressed file
+	int writing;	// 1 if the thread compresses, 0 if it decompresses
+	pthread_t thread;	// thread calling zlib
+	pthread_mutex_t lock;	// guards given, closing and error
+	pthread_cond_t cond;	// signalled whenever a block is handed over
+	char buf[2][GZ_BLOCK];	// the two blocks
+	int len[2];	// amount of chars in a block, an empty one ends the file
+	int given[2];	// 1 while a block is drained, 0 while it is filled
+	int turn;	// block of the FILE side
+	int pos;	// index of the first unread char of the block when reading
+	int closing;	// 1 once the FILE was closed
+	int error;	// 1 if zlib could not read or write the file
+} gz_stream_t;
 
-		if (c == '\n')
+/**
+ * Decompress the file into blocks until its end or until it is closed
+ * @param void *arg - gz_stream_t of the file
+ * @return void * - NULL
+ */
+void *gz_decompress(void *arg)
+{
+	gz_stream_t *z = arg;
+	for (int i = 0, len = 1, closing, errnum = Z_OK; len; i ^= 1)
+	{
+		pthread_mutex_lock(&z->lock);
+		while (z->given[i] && !z->closing)
+			pthread_cond_wait(&z->cond, &z->lock);
+		closing = z->closing;
+		pthread_mutex_unlock(&z->lock);
+		if (closing)
 			break;
+		len = gzread(z->gz, z->buf[i], GZ_BLOCK);
+		// A cut off file only ends early, its error is kept by gzerror
+		if (!len)
+			gzerror(z->gz, &errnum);
+		pthread_mutex_lock(&z->lock);
+		if (len < 0 || (!len && errnum != Z_OK))
+			z->error = 1;
+		z->len[i] = len = len < 0 ? 0 : len;
+		z->given[i] = 1;
+		pthread_cond_signal(&z->cond);
+		pthread_mutex_unlock(&z->lock);
 	}
-	*row++ = '\0';
-	if (c == EOF)
-		return 0;
-	else
-		return i + 1; // if line is empty it would return 0, need > 1 for conditions
+	return NULL;
 }
 
-
 /**
- * Get number of columns after all of the commands changing number of columns
- * @param int no_cols - number of columns before all commands
- * @param user_args_t *user_args - array of all user arguments
- * @param int arg_no - length of user_args array
- * @return int - number of cols adjusted after all
- * the icol, acol, dcol and dcols
+ * Compress blocks into the file until an empty block ends it
+ * @param void *arg - gz_stream_t of the file
+ * @return void * - NULL
  */
-int no_cols_adjust(int no_cols, user_args_t *user_args, int arg_no)
+void *gz_compress(void *arg)
 {
-	for (int i = 0; i < arg_no; i++)
+	gz_stream_t *z = arg;
+	for (int i = 0;; i ^= 1)
 	{
-		int n_arg1 = user_args[i].num_args[0];
-		int n_arg2 = user_args[i].num_args[1];
-		switch(user_args[i].cmd_num)
+		pthread_mutex_lock(&z->lock);
+		while (!z->given[i])
+			pthread_cond_wait(&z->cond, &z->lock);
+		pthread_mutex_unlock(&z->lock);
+		if (!z->len[i])
+			break;
+		// Blocks after an error are only drained, so writing never blocks
+		if (!z->error && gzwrite(z->gz, z->buf[i], z->len[i]) != z->len[i])
 		{
-			case ICOL:
-				no_cols++;
-				break;
-			case ACOL:
-				no_cols++;
-				break;
-			case DCOL:
-				no_cols--;
-				break;
-			case DCOLS:
-				no_cols -= n_arg2 - n_arg1 + 1;
-				break;
+			pthread_mutex_lock(&z->lock);
+			z->error = 1;
+			pthread_mutex_unlock(&z->lock);
 		}
+		pthread_mutex_lock(&z->lock);
+		z->given[i] = 0;
+		pthread_cond_signal(&z->cond);
+		pthread_mutex_unlock(&z->lock);
 	}
-	return no_cols;
+	return NULL;
 }
 
-/*
- * Check for all the things that can go wrong while processing stdin
- * @param char *row - row from stdin
- * @param char *delim - what to use as delimiter
- * @param int prev_cols - number of columns of previous row
- * @return int - 1 if succeeded, 0 if any error encountered
+/**
+ * Read decompressed chars, called by stdio for the FILE of a .gz file
+ * @param void *cookie - gz_stream_t of the file
+ * @param char *buf - where to store the chars
+ * @param size_t size - most chars to read
+ * @return ssize_t - amount of chars read, 0 at the end, -1 if error
  */
-int process_error_handling(char *row, char *delim, int prev_cols, int line_ret)
+ssize_t gz_read(void *cookie, char *buf, size_t size)
 {
-	if (line_ret == TOO_LONG)
+	gz_stream_t *z = cookie;
+	size_t len;
+	int error;
+	pthread_mutex_lock(&z->lock);
+	while (!z->given[z->turn])
+		pthread_cond_wait(&z->cond, &z->lock);
+	error = z->error;
+	pthread_mutex_unlock(&z->lock);
+	// Only the empty block at the end can follow an error
+	if (!z->len[z->turn])
+		return error ? -1 : 0;
+	len = z->len[z->turn] - z->pos;
+	len = len < size ? len : size;
+	memcpy(buf, z->buf[z->turn] + z->pos, len);
+	z->pos += len;
+	if (z->pos == z->len[z->turn])
 	{
-		fprintf(stderr, "Line was too long!\n");
-		return 0;
+		pthread_mutex_lock(&z->lock);
+		z->given[z->turn] = 0;
+		pthread_cond_signal(&z->cond);
+		pthread_mutex_unlock(&z->lock);
+		z->turn ^= 1;
+		z->pos = 0;
 	}
+	return len;
+}
+
+/**
+ * Hand the filled block over to the compressing thread and wait until the
+ * other one is free
+ * @param gz_stream_t *z - written .gz file
+ */
+void gz_give(gz_stream_t *z)
+{
+	pthread_mutex_lock(&z->lock);
+	z->given[z->turn] = 1;
+	pthread_cond_signal(&z->cond);
+	z->turn ^= 1;
+	while (z->given[z->turn])
+		pthread_cond_wait(&z->cond, &z->lock);
+	pthread_mutex_unlock(&z->lock);
+	z->len[z->turn] = 0;
+}
 
-	if(get_no_cols(row, delim) != prev_cols)
+/**
+ * Write chars to be compressed, called by stdio for the FILE of a .gz file
+ * @param void *cookie - gz_stream_t of the file
+ * @param const char *buf - chars to write
+ * @param size_t size - amount of chars
+ * @return ssize_t - amount of chars written, -1 if error
+ */
+ssize_t gz_write(void *cookie, const char *buf, size_t size)
+{
+	gz_stream_t *z = cookie;
+	for (size_t done = 0, len; done < size; done += len)
 	{
-		fprintf(stderr, "Invalid table!\nDifferent amount of columns\n");
-		return 0;
+		if (z->len[z->turn] == GZ_BLOCK)
+			gz_give(z);
+		len = GZ_BLOCK - z->len[z->turn];
+		len = len < size - done ? len : size - done;
+		memcpy(z->buf[z->turn] + z->len[z->turn], buf + done, len);
+		z->len[z->turn] += len;
 	}
-	return 1;
+	pthread_mutex_lock(&z->lock);
+	if (z->error)
+		size = -1;
+	pthread_mutex_unlock(&z->lock);
+	return size;
 }
 
 /**
- * Call correct commands for table modifications
- * @param user_args_t *user_args - array of structs with called commands
- * @param char *delim - what to use as a delimiter
- * @return int - 1 if success, 0 if error
+ * Stop the thread of a .gz file and close the file, called by fclose
+ * @param void *cookie - gz_stream_t of the file
+ * @return int - 0 if the whole file was read or written, EOF otherwise
  */
-int process_mod_commands(user_args_t *user_args, int arg_i, char *delim)
+int gz_close(void *cookie)
 {
-	char row[MAX_ROW];
-	int n_row = 0, init = 0;
-	int no_cols = 0;
-	int no_cols_adjusted = 0;
-	int line_ret;
-	while ((line_ret = load_line(row, delim)))
+	gz_stream_t *z = cookie;
+	int error;
+	if (z->writing)
 	{
-		n_row++;
-		if (!init)
-		{
-			no_cols = get_no_cols(row, delim);
-			no_cols_adjusted = no_cols_adjust(no_cols, user_args, arg_i);
-			init = 1;
-		}
-		if(!process_error_handling(row, delim, no_cols, line_ret))
-			return 0;
-		for (int i = 0; i < arg_i; i++)
-		{
-			int cmd_num = user_args[i].cmd_num;
-			int n_arg1 = user_args[i].num_args[0];
-			int n_arg2 = user_args[i].num_args[1];
-			switch (cmd_num)
-			{
-				case IROW:
-					if (!row_arg_check(n_arg1))
-						return 0;
-					if (n_arg1 == n_row)
-						irow_f(no_cols_adjusted, delim);
-					break;
-				case DROW:
-					if (!row_arg_check(n_arg1))
-						return 0;
-					if (n_arg1 == n_row)
-						drow_f(row);
-					break;
-				case DROWS:
-					if (!(row_arg_check(n_arg1) && row_arg_check(n_arg2)))
-						return 0;
-					if (!two_arg_check(n_arg1, n_arg2))
-						return 0;
-					if (n_arg1 <= n_row && n_arg2 >= n_row)
-						drow_f(row);
-					break;
-				case ICOL:
-					if (!col_arg_check(n_arg1, no_cols))
-						return 0;
-					if (!icol_f(row, n_arg1, delim))
-						return 0;
-					break;
-				case ACOL:
-					if (!acol_f(row, delim))
-						return 0;
-					break;
-				case DCOL:
-					if (!col_arg_check(n_arg1, no_cols))
-						return 0;
-					dcol_f(row, n_arg1, delim);
-					break;
-				case DCOLS:
-					if (!(col_arg_check(n_arg1, no_cols) &&
-						col_arg_check(n_arg2, no_cols)))
-						return 0;
-					if (!two_arg_check(n_arg1, n_arg2))
-						return 0;
-					dcols_f(row, n_arg1, n_arg2, delim);
-					break;
-			}
-		}
-		printf("%s",row);
+		if (z->len[z->turn])
+			gz_give(z);
+		// Empty block ends the file
+		pthread_mutex_lock(&z->lock);
+		z->given[z->turn] = 1;
+		pthread_cond_signal(&z->cond);
+		pthread_mutex_unlock(&z->lock);
+	}
+	else
+	{
+		pthread_mutex_lock(&z->lock);
+		z->closing = 1;
+		pthread_cond_signal(&z->cond);
+		pthread_mutex_unlock(&z->lock);
 	}
+	pthread_join(z->thread, NULL);
+	error = gzclose(z->gz) != Z_OK || z->error;
+	pthread_cond_destroy(&z->cond);
+	pthread_mutex_destroy(&z->lock);
+	free(z);
+	return error ? EOF : 0;
+}
 
-	// Handling AROW must happen after the end of stdin
-	for (int i = 0; i < arg_i; i++)
-		if (user_args[i].cmd_num == AROW)
-			arow_f(no_cols_adjusted, delim);
-	return 1;
+/**
+ * Return 1 if path names a file of the compressed format ext
+ * @param char *path - name of the file
+ * @param char *ext - extension of the format, with its dot
+ * @return int - 1 if path ends with ext, 0 otherwise
+ */
+int is_compressed(char *path, char *ext)
+{
+	size_t len = strlen(path), ext_len = strlen(ext);
+	return len > ext_len && strcmp(path + len - ext_len, ext) == 0;
 }
 
 /**
- * Check if arguments for the rows command are valid
- * @param int arg1 - first line to select
- * @param int arg2 - last line to select
- * @param int dash1 - if to select from the beginning
- * @param int dash2 - if to select until the end
- * @return int - 1 if everything succeeded, 0 if error encountered
+ * Open a file of a table, a .gz file is decompressed or compressed by
+ * a thread of its own, see gz_stream_t
+ * @param char *path - path to the file
+ * @param char *mode - "rb" or "wb"
+ * @param int level - compression level of a written .gz file
+ * @return FILE * - opened file or NULL if it cannot be opened
  */
-int arg_check_rows(int arg1, int arg2, int dash1, int dash2)
+FILE *open_table(char *path, char *mode, int level)
 {
-	if (arg1 < 1 && !dash1)
+	cookie_io_functions_t io = { gz_read, gz_write, NULL, gz_close };
+	char gz_mode[4] = "rb";
+	gz_stream_t *z;
+	FILE *file;
+	if (!is_compressed(path, ".gz"))
+		return open_file(path, mode);
+	if (!(z = calloc(1, sizeof(gz_stream_t))))
 	{
-		fprintf(stderr, "Invalid row number: %d!\n", arg1);
-		return 0;
+		fprintf(errs(), "Not enough memory for %s!\n", path);
+		return NULL;
 	}
-	if (arg2 < 1 && !dash2)
+	z->writing = mode[0] == 'w';
+	if (z->writing)
+		snprintf(gz_mode, sizeof(gz_mode), "wb%d", level);
+	if (!(z->gz = gzopen(path, gz_mode)))
 	{
-		fprintf(stderr, "Invalid row number: %d!\n", arg2);
-		return 0;
+		fprintf(errs(), "Cannot open file %s!\n", path);
+		free(z);
+		return NULL;
 	}
-	if (!(dash1 || dash2) && arg1 > arg2)
+	gzbuffer(z->gz, GZ_BLOCK);
+	pthread_mutex_init(&z->lock, NULL);
+	pthread_cond_init(&z->cond, NULL);
+	if (pthread_create(&z->thread, NULL,
+				z->writing ? gz_compress : gz_decompress, z))
 	{
-		fprintf(stderr, "Invalid arguments: %d !<= %d\n", arg1, arg2);
-		return 0;
+		fprintf(errs(), "Cannot start a thread for %s!\n", path);
+		gzclose(z->gz);
+		pthread_cond_destroy(&z->cond);
+		pthread_mutex_destroy(&z->lock);
+		free(z);
+		return NULL;
 	}
-	return 1;
+	if (!(file = fopencookie(z, z->writing ? "w" : "r", io)))
+	{
+		fprintf(errs(), "Cannot open file %s!\n", path);
+		gz_close(z);
+	}
+	return file;
 }
 
 /**
- * Call correct commands for data manipulation
- * @param user_args_t *user_args - array of structs with called commands
- * @param char *delim - what to use as a delimiter
- * @return int - 1 if success, 0 if error
+ * Load comma separated widths of fixed width columns
+ * @param char *list - widths separated by commas
+ * @param int *widths - array of MAX_FIXED widths to fill
+ * @return int - amount of widths, 0 if list is invalid
  */
-int process_data_commands(user_args_t *user_args, int arg_i, char *delim)
+int load_widths(char *list, int *widths)
 {
-	char row[MAX_ROW];
-	char next[MAX_ROW];
-	int n_row = 0, init = 0;
-	int no_cols = 0;
-	int selected, last_line = 0;
-	int line_ret = load_line(next, delim);
-	while (line_ret)
+	int n = 0, total = 0;
+	char *endptr;
+	while (n < MAX_FIXED)
 	{
-		strcpy(row, next);
-		line_ret = load_line(next, delim);
-		// When last line
-		if (!line_ret)
-			last_line = 1;
-		n_row++;
-		if (!init)
-		{
-			no_cols = get_no_cols(row, delim);
-			init = 1;
-		}
-		if (!process_error_handling(row, delim, no_cols, line_ret))
+		long width = strtol(list, &endptr, 10);
+		// Fixed width row with its newline has to fit into a row
+		if (endptr == list || width <= 0 || width > MAX_ROW ||
+				(total += width) > MAX_ROW - 2)
 			return 0;
-		selected = 1;
-		for (int i = 0; i < arg_i; i++)
-		{
-			int cmd_num = user_args[i].cmd_num;
-			int n_arg1 = user_args[i].num_args[0];
-			int n_arg2 = user_args[i].num_args[1];
-			char *str = user_args[i].str_arg;
-			int dash1 = user_args[i].dash1;
-			int dash2 = user_args[i].dash2;
-			switch(cmd_num)
-			{
-				case CSET:
-					if (!col_arg_check(n_arg1, no_cols))
-						return 0;
-					if(!selected)
-						break;
-					if (!cset_f(row, n_arg1, str, delim))
-						return 0;
-					break;
-				case TOLOWER:
-					if (!col_arg_check(n_arg1, no_cols))
-						return 0;
-					if(!selected)
-						break;
-					tolower_f(row, n_arg1, delim);
-					break;
-				case TOUPPER:
-					if (!col_arg_check(n_arg1, no_cols))
-						return 0;
-					if(!selected)
-						break;
-					toupper_f(row, n_arg1, delim);
-					break;
-				case ROUND:
-					if (!col_arg_check(n_arg1, no_cols))
-						return 0;
-					if(!selected)
-						break;
-					if (!round_f(row, n_arg1, delim))
-						return 0;
-					break;
-				case INT:
-					if (!col_arg_check(n_arg1, no_cols))
-						return 0;
-					if (!selected)
-						break;
-					if (!int_f(row, n_arg1, delim))
-						return 0;
-					break;
-				case COPY:
-					if (!col_arg_check(n_arg1, no_cols))
-						return 0;
-					if (!col_arg_check(n_arg2, no_cols))
-						return 0;
-					if(!selected)
-						break;
-					if (!copy_f(row, n_arg1, n_arg2, delim))
-						return 0;
-					break;
-				case SWAP:
-					if (!col_arg_check(n_arg1, no_cols))
-						return 0;
-					if (!col_arg_check(n_arg2, no_cols))
-						return 0;
-					if(!selected)
-						break;
-					swap_f(row, n_arg1, n_arg2, delim);
-					break;
-				case MOVE:
-					if (!col_arg_check(n_arg1, no_cols))
-						return 0;
-					if (!col_arg_check(n_arg2, no_cols))
-						return 0;
-					if(!selected)
-						break;
-					if (!move_f(row, n_arg1, n_arg2, delim))
-						return 0;
-					break;
-				case ROWS:
-					if (!arg_check_rows(n_arg1, n_arg2, dash1, dash2))
-						return 0;
-					selected = rows_f(n_row, n_arg1, n_arg2, 
-							last_line, dash1, dash2);
-					break;
-				case BEGINSWITH:
-					if (!col_arg_check(n_arg1, no_cols))
-						return 0;
-					selected = beginswith_f(row, n_arg1, str, delim);
-					break;
-				case CONTAINS:
-					if (!col_arg_check(n_arg1, no_cols))
-						return 0;
-					selected = contains_f(row, n_arg1, str, delim);
-					break;
-			}
-		}
-		printf("%s",row);
+		widths[n++] = width;
+		if (!*endptr)
+			return n;
+		if (*endptr != ',')
+			return 0;
+		list = endptr + 1;
 	}
-	return 1;
+	return 0;
+}
+
+/**
+ * Prepare reader for reading the input of program from stream in
+ * @param reader_t *reader - reader to initialize
+ * @param FILE *in - stream to read from, program->chain is read after it
+ * @param const program_t *program - program with delimiters and options
+ */
+void reader_init(reader_t *reader, FILE *in, const program_t *program)
+{
+	char *delim = program->delim;
+	reader->in = in;
+	reader->files = program->chain;
+	reader->own_in = reader->error = 0;
+	reader->follow = program->follow;
+	// Only the last file can grow, a pipe ends for good
+	reader->path = NULL;
+	for (char **file = program->inputs; program->follow && file && *file;
+			file++)
+		reader->path = *file;
+	reader->pos = reader->len = 0;
+	reader->no_cols = 0;
+	reader->base = 0;
+	reader->end = LONG_MAX;
+	reader->last = '\n';
+	reader->n_widths = 0;
+	if (program->fixed_input)
+		reader->n_widths = load_widths(program->fixed_input, reader->widths);
+	reader->delim = delim[0];
+	memset(reader->delim_map, 0, sizeof(reader->delim_map));
+	while (*delim)
+		reader->delim_map[(unsigned char) *delim++] = 1;
 }
 
 /**
- * Just print stdin to stdout unless there was an error
+ * Wait for the followed file to grow. A file that got shorter was truncated
+ * and is read again from its start, a file replaced by another one of the
+ * same name was rotated and the new one is read
+ * @param reader_t *reader - reader at the end of the followed file
+ * @return int - 1 if reading starts over, 0 if the same file goes on
  */
-int handle_no_commands(char *delim)
+int reader_follow(reader_t *reader)
 {
-	char row[MAX_ROW];
-	int line_ret, no_cols, init = 0;
-	while ((line_ret = load_line(row, delim)))
+	struct timespec pause = { 0, FOLLOW_POLL };
+	struct stat now, named;
+	FILE *in;
+	nanosleep(&pause, NULL);
+	clearerr(reader->in);
+	if (fstat(fileno(reader->in), &now))
+		return 0;
+	// A rotated file may not be created yet, until then the old one is read
+	if (!stat(reader->path, &named) &&
+			(named.st_dev != now.st_dev || named.st_ino != now.st_ino) &&
+			(in = fopen(reader->path, "rb")))
 	{
-		if (!init)
+		if (reader->own_in)
+			fclose(reader->in);
+		reader->in = in;
+		reader->own_in = 1;
+		return 1;
+	}
+	if (now.st_size < ftell(reader->in))
+	{
+		rewind(reader->in);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Fill the block of reader from reader->in
+ * fread waits until the whole block is read, which would hold back lines
+ * of a slowly growing input, so when following only a single char is read
+ * and the end of the followed file is waited out
+ * @param reader_t *reader - reader to fill
+ * @return int - amount of chars read, 0 at the end of reader->in
+ */
+int reader_fill(reader_t *reader)
+{
+	int c;
+	if (!reader->in)
+		return 0;
+	if (!reader->follow)
+	{
+		int len = fread(reader->buf, 1, READ_BLOCK, reader->in);
+		if (!len && ferror(reader->in))
 		{
-			no_cols = get_no_cols(row, delim);
-			init = 1;
+			fprintf(errs(), "Cannot read input!\n");
+			reader->error = 1;
 		}
-		if (!process_error_handling(row, delim, no_cols, line_ret))
+		return len;
+	}
+	while ((c = getc(reader->in)) == EOF)
+	{
+		// Chained files before the followed one end as usual
+		if (!reader->path || (reader->files && *reader->files))
 			return 0;
-		printf("%s", row);
+		// Row cut by truncation or rotation ends where it was cut
+		if (reader_follow(reader) && reader->last != '\n')
+		{
+			c = '\n';
+			break;
+		}
 	}
+	reader->buf[0] = c;
 	return 1;
 }
 
-/*
- * Choose correct proccess function to call
- * @param cmd_types_t cmd_types - struct with ammount and types of commands
- * @param user_args_t *user_args - array of structs with user arguments
- * @param int arg_no - length of user_args array
- * @param char *delim - what to use as delimiter
- * @return int - 1 if everything succeeded, 0 if error encountered
+/**
+ * Return next char of the input, read another block if the current one is
+ * exhausted. Reading by blocks avoids the per char locking of getchar
+ * @param reader_t *reader - reader to read from
+ * @return int - next char or EOF if there is no more input
  */
-int handle_commands(cmd_types_t cmd_types, user_args_t *user_args,
-		int arg_no, char *delim)
+int reader_getc(reader_t *reader)
 {
-	if (cmd_types.mod && (cmd_types.data || cmd_types.selection))
+	if (reader->pos == reader->len)
 	{
-		fprintf(stderr, "Unexpected combination of commands!\n");
-		return 0;
+		if (reader->len)
+			reader->last = reader->buf[reader->len - 1];
+		reader->base += reader->len;
+		reader->pos = 0;
+		reader->len = reader_fill(reader);
+		while (!reader->len && reader->files && *reader->files)
+		{
+			// Files follow each other just as with cat, except that a row
+			// never continues in the next file
+			if (reader->last != '\n')
+			{
+				reader->buf[0] = reader->last = '\n';
+				reader->len = 1;
+				break;
+			}
+			if (reader->own_in)
+				fclose(reader->in);
+			reader->own_in = 1;
+			if (!(reader->in = open_table(*reader->files++, "rb", 0)))
+			{
+				reader->own_in = 0;
+				reader->error = 1;
+				return EOF;
+			}
+			reader->len = reader_fill(reader);
+		}
+		if (!reader->len)
+		{
+			if (reader->own_in)
+				fclose(reader->in);
+			reader->own_in = 0;
+			reader->in = NULL;
+			return EOF;
+		}
 	}
-	else if (cmd_types.mod)
+	return (unsigned char) reader->buf[reader->pos++];
+}
+
+/**
+ * Load a fixed width line from the reader, cutting it into columns by the
+ * widths of the reader. Pads are trimmed from the end of every cell, the
+ * last column takes whatever follows it and missing columns are empty.
+ * A delimiter inside a cell would split it once the row is loaded, so
+ * such a row is an error
+ * @param reader_t *reader - where to load the row from
+ * @param char *row - where to store the row with delim between columns
+ * @return int - length of loaded row, TOO_LONG if it exceeds MAX_ROW,
+ * 0 at the end of input or if error encountered, see reader->error
+ */
+int load_fixed(reader_t *reader, char *row)
+{
+	char *start = row, *cell = row;
+	int c = EOF, col = 0, width = 0;
+	// A char and a delim can be stored at once
+	while (row - start < MAX_ROW - 3 && (c = reader_getc(reader)) != EOF &&
+			c != '\n')
 	{
-		if (!process_mod_commands(user_args, arg_no, delim))
+		if (col < reader->n_widths - 1 && width++ == reader->widths[col])
+		{
+			while (row > cell && row[-1] == ' ')
+				row--;
+			*row++ = reader->delim;
+			cell = row;
+			col++;
+			width = 1;
+		}
+		if (reader->delim_map[c])
+		{
+			fprintf(errs(), "Fixed width cell contains a delimiter!\n");
+			reader->error = 1;
 			return 0;
+		}
+		*row++ = c;
 	}
-	else if (cmd_types.data || cmd_types.selection)
+	if (c != EOF && c != '\n')
+		return TOO_LONG;
+	while (row > cell && row[-1] == ' ')
+		row--;
+	for (; col < reader->n_widths - 1; col++)
+		*row++ = reader->delim;
+	if (c == '\n')
+		*row++ = '\n';
+	*row = '\0';
+	reader->no_cols = reader->n_widths;
+	if (c == EOF)
+		return 0;
+	return row - start;
+}
+
+/*
+ * Load a line from the reader and replace all delim characters
+ * Columns are counted while loading and stored in reader->no_cols so the
+ * row does not need to be scanned again by get_no_cols
+ * @param reader_t *reader - where to load the row from
+ * @param char *row - where to store the row from stdin
+ * @return int - length of loaded row, TOO_LONG if it exceeds MAX_ROW,
+ * 0 at the end of input
+ */
+int load_line(reader_t *reader, char *row)
+{
+	int i, c = EOF, no_delims = 0;
+	// Row starting past the range belongs to the next shard
+	if (reader->base + reader->pos >= reader->end)
+		return 0;
+	if (reader->n_widths)
+		return load_fixed(reader, row);
+	for(i = 0; i < MAX_ROW - 1 && (c = reader_getc(reader)) != EOF; i++)
 	{
-		// Selection must always come before data commands otherwise
-		// it does not work, this was specified in the forums however
-		// if more selections are called it uses a union of those
-		if (!process_data_commands(user_args, arg_no, delim))
-			return 0;
+		// replace delim if delim
+		if (reader->delim_map[c])
+		{
+			*row++ = reader->delim;
+			no_delims++;
+		}
+		else
+			*row++ = c;
+
+		// Works thanks to short circuit boolean logic in C
+		if (i == MAX_ROW - 2 && reader_getc(reader) != EOF)
+			return TOO_LONG;
+
+		if (c == '\n')
+			break;
 	}
-	else if (!handle_no_commands(delim))
+	*row++ = '\0';
+	// Number of columns is number of delims + 1
+	reader->no_cols = no_delims + 1;
+	if (c == EOF)
 		return 0;
-
-	return 1;
+	else if (c != '\n')
+		return i; // line filled the whole row without a newline
+	else
+		return i + 1; // if line is empty it would return 0, need > 1 for conditions
 }
 
 
 /**
- * Check if it is a valid string argument
- * valid string arguments are either arg #2 for cset 
- * or - for rows or arg #2 for beginswith
- * @param char *argv - arugment to check
- * @param int cmd_num - number of command called
- * @param int index - index of num_arg inside the user_args_t struct
- * @param user_args_t *users_args - array of user arguments
- * @return 1 if it is a valid string arugment, 0 otherwise
- * set dash1 or dash2 if called with rows
+ * Get number of columns after all of the commands changing number of columns
+ * @param int no_cols - number of columns before all commands
+ * @param user_args_t *user_args - array of all user arguments
+ * @param int arg_no - length of user_args array
+ * @return int - number of cols adjusted after all
+ * the icol, acol, dcol and dcols
  */
-int valid_str_arg(char *argv, int cmd_num, int index,
-		user_args_t *user_args)
+int no_cols_adjust(int no_cols, user_args_t *user_args, int arg_no)
 {
-	if(cmd_num == CSET && index == 1)
-		return 1;
-	if(cmd_num == BEGINSWITH && index == 1)
-		return 1;
-	if(cmd_num == CONTAINS && index == 1)
-		return 1;
-	if(cmd_num == ROWS && (strcmp("-", argv) == 0))
+	for (int i = 0; i < arg_no; i++)
 	{
-		if (index == 0)
-			user_args->dash1 = 1;
-		if (index == 1)
-			user_args->dash2 = 1;
-		return 1;
+		int n_arg1 = user_args[i].num_args[0];
+		int n_arg2 = user_args[i].num_args[1];
+		switch(user_args[i].cmd_num)
+		{
+			case ICOL:
+				no_cols++;
+				break;
+			case ACOL:
+				no_cols++;
+				break;
+			case DCOL:
+				no_cols--;
+				break;
+			case DCOLS:
+				no_cols -= n_arg2 - n_arg1 + 1;
+				break;
+			case JOIN:
+				no_cols += user_args[i].table->no_cols;
+				break;
+		}
 	}
-	return 0;
+	return no_cols;
 }
 
-/**
- * Check if it is a valid number argument
- * @param char *argv - arugment to check
- * @param int index - index of num_arg inside the user_args_t struct
- * @param user_args_t *users_args - array of user arguments
- * @return 1 if it is a valid number arugment, 0 otherwise
+/*
+ * Check for all the things that can go wrong while processing stdin
+ * @param int no_cols - number of columns of the row, counted by load_line
+ * @param int prev_cols - number of columns of previous row
+ * @param int line_ret - return value of load_line
+ * @return int - 1 if succeeded, 0 if any error encountered
  */
-int valid_num_arg(char *argv, int index, user_args_t *user_args)
+int process_error_handling(int no_cols, int prev_cols, int line_ret)
 {
-	char *endptr, function_name[LENGTH_NAME];
-	int cmd_num = user_args->cmd_num;
-	user_args->num_args[index] = strtol(argv, &endptr, 10);
-	if (*endptr)
+	if (line_ret == TOO_LONG)
 	{
-		strcpy(function_name, commands_s[cmd_num].name);
-		fprintf(
-			stderr,
-			"Invalid argument %s for command %s.\nNumber expected\n",
-			endptr, function_name);
+		fprintf(errs(), "Line was too long!\n");
+		return 0;
+	}
+
+	if(no_cols != prev_cols)
+	{
+		fprintf(errs(), "Invalid table!\nDifferent amount of columns\n");
 		return 0;
 	}
 	return 1;
 }
 
 /**
- * Loads user arguments for a command with cmd_num into user_args
- * @param char **argv - passing command line arguments
- * @param int *user_args - pointer to user_args structure to load information
- * @param char *str - argument for cset
- * @return int 1 if everything went well, 0 otherwise
+ * Count columns of a line in the block of the reader, other delimiters of
+ * the set are replaced in place just as load_line would
+ * @param reader_t *reader - reader holding the line
+ * @param char *line - first char of the line
+ * @param char *end - newline ending the line
+ * @param int single - 1 if the delimiter set has a single char
+ * @return int - number of columns of the line
  */
-int load_command_user_args(char **argv, user_args_t *user_args)
+int block_line_cols(reader_t *reader, char *line, char *end, int single)
 {
-	int cmd_num = user_args->cmd_num;
-	int i, no_args = commands_s[cmd_num].no_args;
-	char function_name[LENGTH_NAME];
-	user_args->dash1 = user_args->dash2 = 0;
-	for (i = 0; i < no_args; i++)
+	int no_cols = 1;
+	if (single)
 	{
-		if (*++argv)
+		// memchr is much faster than checking the chars one by one
+		while ((line = memchr(line, reader->delim, end - line)))
 		{
-			if (valid_str_arg(*argv, cmd_num, i, user_args))
-			{
-				if (strlen(*argv) >= MAX_CELL)
-				{
-					fprintf(stderr, "Argument %s too long.\n", *argv);
-					return 0;
-				}
-				strcpy(user_args->str_arg, *argv);
-			}
-			else if (!valid_num_arg(*argv, i, user_args))
-				return 0;
+			no_cols++;
+			line++;
 		}
-		else
+		return no_cols;
+	}
+	for (; line < end; line++)
+		if (reader->delim_map[(unsigned char) *line])
 		{
-			strcpy(function_name, commands_s[cmd_num].name);
-			fprintf(stderr, "Invalid amount of arguments for command %s\n",
-					function_name);
-			return 0;
+			*line = reader->delim;
+			no_cols++;
 		}
-	}
-	return 1;
+	return no_cols;
 }
 
-int main(int argc, char **argv)
+/**
+ * Write up to n rows straight from the blocks of the reader to out, while
+ * they have no_cols columns. Rows are neither copied nor loaded one by
+ * one, only checked in place. Stops at a row it cannot pass whole, which
+ * is left to load_line, be it an invalid row, a too long one or the one
+ * continuing in the next block
+ * @param reader_t *reader - reader to pass the rows of
+ * @param FILE *out - where to write the rows, NULL to skip them
+ * @param int no_cols - number of columns every row must have
+ * @param long n - most rows to pass
+ * @return long - amount of rows passed
+ */
+long reader_pass(reader_t *reader, FILE *out, int no_cols, long n)
 {
-	char *delim = " ";
-
-	user_args_t user_args[argc];
-	int arg_i = 0;
-	cmd_types_t cmd_types = { 0, 0, 0 };
-
-	while (*++argv)
+	long passed = 0;
+	int single = 0;
+	for (int c = 0; c <= UCHAR_MAX; c++)
+		single += reader->delim_map[c];
+	single = single == 1 && reader->delim_map[(unsigned char) reader->delim];
+	while (passed < n)
 	{
-		if (strcmp(*argv, "-d") == 0)
+		char *start, *line, *end, *newline;
+		if (reader->pos == reader->len)
 		{
-			if (*++argv)
-				delim = *argv;
-			else
-			{
-				fprintf(stderr, "Delimiter not given!\n");
-				return 1;
-			}
+			// reader_getc refills the buffer and opens the next file
+			if (reader_getc(reader) == EOF)
+				break;
+			reader->pos--;
 		}
-		else if (is_command(*argv, &user_args[arg_i]))
+		start = line = reader->buf + reader->pos;
+		end = reader->buf + reader->len;
+		while (passed < n && (newline = memchr(line, '\n', end - line)) &&
+				newline - line < MAX_ROW - 2 &&
+				block_line_cols(reader, line, newline, single) == no_cols)
 		{
-			if (load_command_user_args(argv, &user_args[arg_i]))
+			line = newline + 1;
+			passed++;
+		}
+		if (out)
+			fwrite(start, 1, line - start, out);
+		reader->pos = line - reader->buf;
+		if (line != end)
+			break;
+	}
+	return passed;
+}
+
+/**
+ * Skip up to n rows without loading them, they are still checked to have
+ * no_cols columns just as loaded rows are, see reader_pass
+ * @param reader_t *reader - reader to skip rows of
+ * @param long n - most rows to skip
+ * @param int no_cols - number of columns every row must have
+ * @return long - amount of skipped rows, the next one is left to load_line
+ */
+long reader_skip(reader_t *reader, long n, int no_cols)
+{
+	return reader_pass(reader, NULL, no_cols, n);
+}
+
+/**
+ * Return 1 if a command of program or of the programs after it depends on
+ * the number of the row
+ * @param const program_t *program - first of the programs
+ * @return int - 1 if row numbers are needed, 0 otherwise
+ */
+int needs_row_numbers(const program_t *program)
+{
+	for (; program; program = program->then)
+		for (int i = 0; i < program->arg_no; i++)
+			switch (program->user_args[i].cmd_num)
 			{
-				int cmd_num = user_args[arg_i++].cmd_num;
-				// move argv pointer by number of arguments, if it suceeded this
-				// many arguments were already parsed, otherwise it failed and
-				// wont even get here
-				argv += commands_s[cmd_num].no_args;
-				if (IS_MOD(cmd_num))
-					cmd_types.mod += 1;
-				if (IS_DATA(cmd_num))
-					cmd_types.data += 1;
-				if (IS_SELECTION(cmd_num))
-					cmd_types.selection += 1;
+				case IROW:
+				case DROW:
+				case DROWS:
+				case ROWS:
+					return 1;
 			}
-			else
-				return EXIT_FAILURE;
-		}
-		else
+	return 0;
+}
+
+/**
+ * Limit reader to the rows starting in the byte range of the program,
+ * given either by --byte-range or by --shard. The reader continues after
+ * the first newline of the range, the row before it belongs to the range
+ * it started in
+ * @param reader_t *reader - freshly initialized reader of a file
+ * @param const program_t *program - program with the range
+ * @return long - amount of rows before the range, NOT_FOUND if error
+ * encountered
+ */
+long reader_range(reader_t *reader, const program_t *program)
+{
+	long start = program->range_start, end = program->range_end, size;
+	long rows = 0;
+	int c;
+	if (fseek(reader->in, 0, SEEK_END) || (size = ftell(reader->in)) < 0 ||
+			fseek(reader->in, 0, SEEK_SET))
+	{
+		fprintf(errs(), "Cannot seek in the input!\n");
+		return NOT_FOUND;
+	}
+	if (program->shards)
+	{
+		start = (long) ((double) size * (program->shard - 1) /
+				program->shards);
+		end = (long) ((double) size * program->shard / program->shards);
+	}
+	if (start > size)
+		start = size;
+
+	if (program->first_row)
+		rows = program->first_row - 1;
+	else if (start && needs_row_numbers(program))
+	{
+		// Every newline before start - 1 starts a row before the range
+		rows = 1;
+		while (reader->base + reader->len < start - 1 &&
+				(reader->len = fread(reader->buf, 1, READ_BLOCK, reader->in)))
 		{
-			fprintf(stderr, "Unexpected argument %s\n", *argv);
-			return EXIT_FAILURE;
+			int len = reader->len;
+			if (reader->base + len > start - 1)
+				len = start - 1 - reader->base;
+			for (char *c = reader->buf; (c = memchr(c, '\n',
+							reader->buf + len - c)); c++)
+				rows++;
+			reader->base += reader->len;
+			reader->len = 0;
 		}
 	}
 
-	if(!handle_commands(cmd_types, user_args, arg_i, delim))
+	if (start && fseek(reader->in, start - 1, SEEK_SET))
+	{
+		fprintf(errs(), "Cannot seek in the input!\n");
+		return NOT_FOUND;
+	}
+	reader->base = start ? start - 1 : 0;
+	reader->pos = reader->len = 0;
+	if (start)
+		while ((c = reader_getc(reader)) != EOF && c != '\n')
+			;
+	// Reading the last shard does not stop before the end of the file
+	reader->end = end < size ? end : LONG_MAX;
+	return rows;
+}
+
+/**
+ * Write the sidecar of a shard next to its output, so merge_shards can
+ * check that the outputs of all the shards follow each other
+ * @param const program_t *program - program with the range and the output
+ * @param long first_row - number of the first row of the shard, stored as 0
+ * if reader_range did not count the rows before the shard
+ * @param long rows - amount of rows read from the shard
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int shard_save(const program_t *program, long first_row, long rows)
+{
+	char path[FILENAME_MAX];
+	FILE *file;
+	long start = program->range_start, end = program->range_end;
+	if (program->shards)
+	{
+		// Shards are stored by their number, which is known without size
+		start = program->shard - 1;
+		end = program->shard;
+	}
+	if (start && !program->first_row && !needs_row_numbers(program))
+		first_row = 0;
+	snprintf(path, FILENAME_MAX, "%s.shard", program->outputs[0]);
+	if (!(file = open_file(path, "w")))
+		return 0;
+	fprintf(file, "sheet-shard %d %ld %ld %ld %ld\n", program->shards, start,
+			end, first_row, rows);
+	if (fclose(file) == EOF)
+	{
+		fprintf(errs(), "Cannot write file %s!\n", path);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Return offset of the first char of input the reader did not return yet
+ * @param reader_t *reader - reader to ask
+ * @return long - offset in reader->in
+ */
+long reader_tell(reader_t *reader)
+{
+	return ftell(reader->in) - (reader->len - reader->pos);
+}
+
+/**
+ * Store progress into the checkpoint file every CHECKPOINT_ROWS rows
+ * The file is written next to the checkpoint and renamed over it, so a
+ * crash never leaves a half written checkpoint
+ * @param const program_t *program - program with the checkpoint file
+ * @param reader_t *reader - reader of the table
+ * @param FILE *out - stream with the result
+ * @param long n_row - number of the last row written to out
+ * @param int ahead - amount of chars the caller has loaded ahead of n_row
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int checkpoint_save(const program_t *program, reader_t *reader, FILE *out,
+		long n_row, int ahead)
+{
+	char tmp[FILENAME_MAX];
+	FILE *file;
+	// Once the input ended there is nothing left to resume
+	if (!program->checkpoint || n_row % CHECKPOINT_ROWS || !reader->in)
+		return 1;
+
+	fflush(out);
+	snprintf(tmp, FILENAME_MAX, "%s.tmp", program->checkpoint);
+	if (!(file = open_file(tmp, "w")))
+		return 0;
+	fprintf(file, "sheet-checkpoint %u %ld %ld %ld\n", program->hash,
+			reader_tell(reader) - ahead, ftell(out), n_row);
+	if (fclose(file) == EOF || rename(tmp, program->checkpoint))
+	{
+		fprintf(errs(), "Cannot write checkpoint %s!\n", program->checkpoint);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Seek input and output to the state stored in the checkpoint file
+ * Output past the stored offset is overwritten by the same rows again
+ * @param const program_t *program - program with the checkpoint file
+ * @param reader_t *reader - freshly initialized reader of the table
+ * @param FILE *out - stream with the result
+ * @return long - number of the last row already written, 0 if not resuming,
+ * NOT_FOUND if error encountered
+ */
+long checkpoint_resume(const program_t *program, reader_t *reader, FILE *out)
+{
+	unsigned hash;
+	long in_offset, out_offset, n_row, size;
+	int loaded;
+	FILE *file;
+	if (!program->resume)
+		return 0;
+
+	if (!(file = open_file(program->checkpoint, "r")))
+		return NOT_FOUND;
+	loaded = fscanf(file, "sheet-checkpoint %u %ld %ld %ld", &hash,
+			&in_offset, &out_offset, &n_row);
+	fclose(file);
+	if (loaded != 4 || hash != program->hash)
+	{
+		fprintf(errs(), "Checkpoint %s does not match the commands!\n",
+				program->checkpoint);
+		return NOT_FOUND;
+	}
+	if (fseek(out, 0, SEEK_END) || (size = ftell(out)) < 0)
+	{
+		fprintf(errs(), "Cannot seek to the checkpoint!\n");
+		return NOT_FOUND;
+	}
+	// Seeking past the end would leave a hole of zeros in the output
+	if (size < out_offset)
+	{
+		fprintf(errs(), "Output is shorter than checkpoint %s!\n",
+				program->checkpoint);
+		return NOT_FOUND;
+	}
+	if (fseek(reader->in, in_offset, SEEK_SET) ||
+			fseek(out, out_offset, SEEK_SET))
+	{
+		fprintf(errs(), "Cannot seek to the checkpoint!\n");
+		return NOT_FOUND;
+	}
+	return n_row;
+}
+
+/**
+ * Check column arguments of mod commands, they depend on the number of columns
+ * so they are checked once per table, row arguments are checked by
+ * row_args_check when the program is loaded
+ * @param user_args_t *user_args - array of structs with called commands
+ * @param int arg_i - length of user_args array
+ * @param int no_cols - number of columns of the table
+ * @return int - 1 if all arguments are valid, 0 otherwise
+ */
+int mod_args_check(user_args_t *user_args, int arg_i, int no_cols)
+{
+	for (int i = 0; i < arg_i; i++)
+	{
+		int n_arg1 = user_args[i].num_args[0];
+		int n_arg2 = user_args[i].num_args[1];
+		switch (user_args[i].cmd_num)
+		{
+			case ICOL:
+			case DCOL:
+			case JOIN:
+				if (!col_arg_check(n_arg1, no_cols))
+					return 0;
+				break;
+			case DCOLS:
+				if (!(col_arg_check(n_arg1, no_cols) &&
+					col_arg_check(n_arg2, no_cols)))
+					return 0;
+				if (!two_arg_check(n_arg1, n_arg2))
+					return 0;
+				break;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Split row of a joined table into its key column and the other columns
+ * @param char *line - row with all delimiters replaced by delim
+ * @param int key_col - number of the key column
+ * @param char delim - delimiter of the columns
+ * @param char *key - where to put the key column, MAX_ROW long
+ * @param char *rest - where to put the other columns, MAX_ROW long
+ */
+void join_split(char *line, int key_col, char delim, char *key, char *rest)
+{
+	int first = 1;
+	key[0] = '\0';
+	for (int col = 1; ; col++)
+	{
+		char *end = line;
+		while (*end && *end != '\n' && *end != delim)
+			end++;
+		if (col == key_col)
+		{
+			memcpy(key, line, end - line);
+			key[end - line] = '\0';
+		}
+		else
+		{
+			if (!first)
+				*rest++ = delim;
+			memcpy(rest, line, end - line);
+			rest += end - line;
+			first = 0;
+		}
+		if (*end != delim)
+			break;
+		line = end + 1;
+	}
+	*rest = '\0';
+}
+
+/**
+ * Return index of the slot holding key or of the empty slot it belongs to
+ * @param join_table_t *table - table to search
+ * @param char *key - key to find
+ * @return long - index into table->slots
+ */
+long join_slot(join_table_t *table, char *key)
+{
+	long mask = table->n_slots - 1, slot = cell_hash(key) & mask;
+	while (table->slots[slot] != NOT_FOUND &&
+			strcmp(table->arena + table->slots[slot], key))
+		slot = (slot + 1) & mask;
+	return slot;
+}
+
+/**
+ * Add row to the table unless a row with the same key is already there
+ * @param join_table_t *table - table to add to
+ * @param char *key - key column of the row
+ * @param char *rest - other columns of the row
+ * @param long offset - offset of the row in the file of the table
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int join_insert(join_table_t *table, char *key, char *rest, long offset)
+{
+	long slot, length;
+	// Keep the hash table at most half full
+	if ((table->n_rows + 1) * 2 > table->n_slots)
+	{
+		long *old = table->slots, n_old = table->n_slots;
+		if (!(table->slots = malloc(n_old * 2 * sizeof(long))))
+		{
+			table->slots = old;
+			fprintf(errs(), "Not enough memory for join!\n");
+			return 0;
+		}
+		table->n_slots = n_old * 2;
+		for (long i = 0; i < table->n_slots; i++)
+			table->slots[i] = NOT_FOUND;
+		for (long i = 0; i < n_old; i++)
+			if (old[i] != NOT_FOUND)
+				table->slots[join_slot(table, table->arena + old[i])] = old[i];
+		free(old);
+	}
+	// The first row with a key wins
+	if (table->slots[slot = join_slot(table, key)] != NOT_FOUND)
+		return 1;
+
+	length = strlen(key) + 1 +
+			(table->path ? (long) sizeof(long) : (long) strlen(rest) + 1);
+	if (table->used + length > table->size)
+	{
+		long size = table->size ? table->size : READ_BLOCK;
+		char *arena;
+		while (table->used + length > size)
+			size *= 2;
+		if (!(arena = realloc(table->arena, size)))
+		{
+			fprintf(errs(), "Not enough memory for join!\n");
+			return 0;
+		}
+		table->arena = arena;
+		table->size = size;
+	}
+	table->slots[slot] = table->used;
+	strcpy(table->arena + table->used, key);
+	table->used += strlen(key) + 1;
+	if (table->path)
+	{
+		memcpy(table->arena + table->used, &offset, sizeof(long));
+		table->used += sizeof(long);
+	}
+	else
+	{
+		strcpy(table->arena + table->used, rest);
+		table->used += strlen(rest) + 1;
+	}
+	table->n_rows++;
+	return 1;
+}
+
+/**
+ * Load the table of a join command into a hash table by its key column
+ * Tables larger than JOIN_MEMORY keep only the keys in memory and the rows
+ * are read from the file when they match
+ * @param const program_t *program - program with the delimiters
+ * @param user_args_t *args - join command, the table is stored in it
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int join_load(const program_t *program, user_args_t *args)
+{
+	char *path = args->str_arg;
+	char line[MAX_ROW], key[MAX_ROW], rest[MAX_ROW];
+	int key_col = args->num_args[2], line_ret, no_cols = 0;
+	long offset = 0;
+	program_t alone = *program;	// the table is read without chained files
+	join_table_t *table;
+	reader_t reader;
+	FILE *file = open_file(path, "rb");
+	if (!file)
+		return 0;
+	if (!(table = args->table = calloc(1, sizeof(join_table_t))) ||
+			!(table->slots = malloc(JOIN_SLOTS * sizeof(long))))
+	{
+		fprintf(errs(), "Not enough memory for join!\n");
+		fclose(file);
+		return 0;
+	}
+	table->n_slots = JOIN_SLOTS;
+	for (long i = 0; i < table->n_slots; i++)
+		table->slots[i] = NOT_FOUND;
+	table->key_col = key_col;
+	if (!fseek(file, 0, SEEK_END) && ftell(file) > JOIN_MEMORY)
+		table->path = path;
+	rewind(file);
+
+	alone.chain = NULL;
+	alone.follow = 0;
+	reader_init(&reader, file, &alone);
+	while ((line_ret = load_line(&reader, line)))
+	{
+		if (line_ret == TOO_LONG)
+		{
+			fprintf(errs(), "Row of join table %s too long!\n", path);
+			break;
+		}
+		if (!no_cols && !col_arg_check(key_col, no_cols = reader.no_cols))
+			break;
+		if (reader.no_cols != no_cols)
+		{
+			fprintf(errs(), "Rows of join table %s differ in columns!\n",
+					path);
+			break;
+		}
+		join_split(line, key_col, reader.delim, key, rest);
+		if (!join_insert(table, key, rest, offset))
+			break;
+		offset += line_ret;
+	}
+	table->no_cols = no_cols ? no_cols - 1 : 0;
+	fclose(file);
+	return !line_ret && !reader.error;
+}
+
+/**
+ * Append columns of the row of the joined table with the same key in
+ * column col, the key column itself is not appended
+ * @param char *row - row to join
+ * @param int col - number of the key column in row
+ * @param join_table_t *table - loaded table
+ * @param FILE *file - own stream of the table if it is kept on disk
+ * @param int mode - INNER_JOIN or LEFT_JOIN, what to do without a match
+ * @param char *delim - string of delim characters
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int join_f(char *row, int col, join_table_t *table, FILE *file, int mode,
+		char *delim)
+{
+	char key[MAX_ROW], line[MAX_ROW], rest[MAX_ROW], *found = NULL;
+	char *cell = row;
+	int length = strlen(row), newline, base, key_len = 0;
+	long slot;
+	// Deleted row stays deleted
+	if (!length)
+		return 1;
+
+	for (int n_col = 1; n_col < col && *cell; cell++)
+		if (is_delim(*cell, delim))
+			n_col++;
+	while (cell[key_len] && cell[key_len] != '\n' &&
+			!is_delim(cell[key_len], delim))
+		key_len++;
+	memcpy(key, cell, key_len);
+	key[key_len] = '\0';
+
+	slot = join_slot(table, key);
+	if (table->slots[slot] != NOT_FOUND)
+	{
+		found = table->arena + table->slots[slot] + key_len + 1;
+		if (table->path)
+		{
+			long offset;
+			memcpy(&offset, found, sizeof(long));
+			if (fseek(file, offset, SEEK_SET) || !fgets(line, MAX_ROW, file))
+			{
+				fprintf(errs(), "Cannot read join table!\n");
+				return 0;
+			}
+			for (char *c = line; *c; c++)
+				if (is_delim(*c, delim))
+					*c = delim[0];
+			join_split(line, table->key_col, delim[0], key, rest);
+			found = rest;
+		}
+	}
+	else if (mode == INNER_JOIN)
+	{
+		drow_f(row);
+		return 1;
+	}
+
+	// Columns are added in front of the newline
+	newline = row[length - 1] == '\n';
+	base = length - newline;
+	if (!table->no_cols)
+		return 1;
+	if (base + (found ? (int) strlen(found) + 1 : table->no_cols) + newline >=
+			MAX_ROW)
+	{
+		fprintf(errs(), "Line limit exceeded.\n");
+		return 0;
+	}
+	if (found)
+	{
+		row[base++] = delim[0];
+		strcpy(row + base, found);
+		base += strlen(found);
+	}
+	else
+	{
+		memset(row + base, delim[0], table->no_cols);
+		base += table->no_cols;
+	}
+	if (newline)
+		row[base++] = '\n';
+	row[base] = '\0';
+	return 1;
+}
+
+/**
+ * Free a table loaded by join_load
+ * @param join_table_t *table - table to free
+ */
+void join_free(join_table_t *table)
+{
+	free(table->arena);
+	free(table->slots);
+	free(table);
+}
+
+/**
+ * Put value of column of row into name, so it can be used as a file name
+ * Chars other than letters, digits, '-', '_' and '.' are written as %XX,
+ * so the value can never leave the directory and two values never share
+ * a file. A leading '.' is encoded too and empty value is named "%"
+ * @param char *row - row to take the value from
+ * @param char *delim - string of delim characters
+ * @param int column - number of the column, starting from 1
+ * @param char *name - where to write the name, PARTITION_NAME long
+ * @return int - 1 if succeeded, 0 if the name would be too long
+ */
+int partition_name(char *row, char *delim, int column, char *name)
+{
+	int col = 1, length = 0;
+	for (; *row && *row != '\n' && col < column; row++)
+		if (is_delim(*row, delim))
+			col++;
+	for (; col == column && *row && *row != '\n' && !is_delim(*row, delim);
+			row++)
+	{
+		unsigned char c = *row;
+		if (length > PARTITION_NAME - 4)
+		{
+			fprintf(errs(), "Value of column %d is too long to name a "
+					"partition!\n", column);
+			return 0;
+		}
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+				(c >= '0' && c <= '9') || c == '-' || c == '_' ||
+				(c == '.' && length))
+			name[length++] = c;
+		else
+			length += sprintf(name + length, "%%%02X", c);
+	}
+	if (!length)
+		name[length++] = '%';
+	name[length] = '\0';
+	return 1;
+}
+
+/**
+ * Prepare writer for a single table
+ * @param writer_t *writer - writer to initialize
+ * @param const program_t *program - program with the partition column
+ * @param FILE *out - stream to write to when not partitioning
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int writer_init(writer_t *writer, const program_t *program, FILE *out)
+{
+	writer->out = out;
+	writer->delim = program->delim;
+	writer->column = program->partition_by;
+	writer->dir = program->out_dir;
+	writer->parts = NULL;
+	writer->n_open = 0;
+	writer->head = writer->tail = NULL;
+	writer->n_widths = 0;
+	if (program->fixed_output)
+		writer->n_widths = load_widths(program->fixed_output, writer->widths);
+	if (!writer->column)
+		return 1;
+	writer->n_slots = PARTITION_SLOTS;
+	writer->n_parts = 0;
+	if (!(writer->parts = calloc(PARTITION_SLOTS, sizeof(partition_t))))
+	{
+		fprintf(errs(), "Not enough memory for partitions!\n");
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Return slot of partition named name, or the empty slot it would take
+ * @param partition_t *parts - hash table of partitions
+ * @param long n_slots - length of parts, a power of 2
+ * @param char *name - name of the partition
+ * @return long - index of the slot
+ */
+long partition_slot(partition_t *parts, long n_slots, char *name)
+{
+	long slot = cell_hash(name) & (n_slots - 1);
+	while (parts[slot].name[0] && strcmp(parts[slot].name, name))
+		slot = (slot + 1) & (n_slots - 1);
+	return slot;
+}
+
+/**
+ * Take an open partition out of the list of open files
+ * @param writer_t *writer - partitioning writer
+ * @param partition_t *part - partition to take out
+ */
+void partition_unlink(writer_t *writer, partition_t *part)
+{
+	if (part->prev)
+		part->prev->next = part->next;
+	else
+		writer->head = part->next;
+	if (part->next)
+		part->next->prev = part->prev;
+	else
+		writer->tail = part->prev;
+	part->prev = part->next = NULL;
+}
+
+/**
+ * Put an open partition in front of the list of open files
+ * @param writer_t *writer - partitioning writer
+ * @param partition_t *part - partition not in the list
+ */
+void partition_push(writer_t *writer, partition_t *part)
+{
+	part->prev = NULL;
+	part->next = writer->head;
+	if (writer->head)
+		writer->head->prev = part;
+	else
+		writer->tail = part;
+	writer->head = part;
+}
+
+/**
+ * Double the hash table of partitions of writer
+ * @param writer_t *writer - partitioning writer
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int writer_grow(writer_t *writer)
+{
+	long n_slots = writer->n_slots * 2;
+	partition_t *parts = calloc(n_slots, sizeof(partition_t)), *old;
+	if (!parts)
+	{
+		fprintf(errs(), "Not enough memory for partitions!\n");
+		return 0;
+	}
+	for (long i = 0; i < writer->n_slots; i++)
+		if (writer->parts[i].name[0])
+			parts[partition_slot(parts, n_slots, writer->parts[i].name)] =
+				writer->parts[i];
+	// Partitions moved, so the list of open files is linked again in the
+	// same order
+	old = writer->head;
+	writer->head = writer->tail = NULL;
+	for (; old; old = old->next)
+	{
+		partition_t *part = &parts[partition_slot(parts, n_slots, old->name)];
+		part->next = NULL;
+		part->prev = writer->tail;
+		if (writer->tail)
+			writer->tail->next = part;
+		else
+			writer->head = part;
+		writer->tail = part;
+	}
+	free(writer->parts);
+	writer->parts = parts;
+	writer->n_slots = n_slots;
+	return 1;
+}
+
+/**
+ * Return file of the partition named name, the least recently used file is
+ * closed when PARTITION_OPEN files are already open and reopened for
+ * appending once it is needed again
+ * @param writer_t *writer - partitioning writer
+ * @param char *name - name of the partition
+ * @return FILE * - file of the partition, NULL if error encountered
+ */
+FILE *writer_partition(writer_t *writer, char *name)
+{
+	char path[FILENAME_MAX];
+	int existed = 1;
+	partition_t *part, *lru;
+	// Kept at most half full, so probing stays short
+	if (writer->n_parts * 2 >= writer->n_slots && !writer_grow(writer))
+		return NULL;
+	part = &writer->parts[partition_slot(writer->parts, writer->n_slots,
+			name)];
+	if (!part->name[0])
+	{
+		strcpy(part->name, name);
+		writer->n_parts++;
+		existed = 0;
+	}
+	if (part->file)
+	{
+		if (part != writer->head)
+		{
+			partition_unlink(writer, part);
+			partition_push(writer, part);
+		}
+		return part->file;
+	}
+
+	if (writer->n_open == PARTITION_OPEN)
+	{
+		lru = writer->tail;
+		partition_unlink(writer, lru);
+		if (fclose(lru->file) == EOF)
+		{
+			fprintf(errs(), "Cannot write partition %s!\n", lru->name);
+			lru->file = NULL;
+			return NULL;
+		}
+		lru->file = NULL;
+		writer->n_open--;
+	}
+	snprintf(path, FILENAME_MAX, "%s/%s", writer->dir, name);
+	if (!(part->file = open_file(path, existed ? "ab" : "wb")))
+		return NULL;
+	setvbuf(part->file, NULL, _IOFBF, PARTITION_BLOCK);
+	partition_push(writer, part);
+	writer->n_open++;
+	return part->file;
+}
+
+/**
+ * Pad or truncate every cell of row to the width of its column
+ * @param writer_t *writer - writer with the widths
+ * @param char *row - row with the same amount of columns as widths
+ * @param int len - length of row
+ * @param char *out - where to store the fixed width row
+ * @return int - length of the fixed width row
+ */
+int writer_fixed(writer_t *writer, char *row, int len, char *out)
+{
+	char *start = out, *end = row + len, delim = writer->delim[0];
+	int newline = len && end[-1] == '\n';
+	if (!len)
+		return 0;
+	if (newline)
+		end--;
+	for (int col = 0; col < writer->n_widths; col++)
+	{
+		int width = writer->widths[col];
+		for (; row < end && *row != delim && width; width--)
+			*out++ = *row++;
+		for (; width; width--)
+			*out++ = ' ';
+		// Skip what did not fit and the delim after it
+		while (row < end && *row != delim)
+			row++;
+		if (row < end)
+			row++;
+	}
+	if (newline)
+		*out++ = '\n';
+	return out - start;
+}
+
+/**
+ * Write len chars of row to the output or to its partition
+ * @param writer_t *writer - where to write
+ * @param char *row - row to write
+ * @param int len - length of row
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int writer_put(writer_t *writer, char *row, int len)
+{
+	char name[PARTITION_NAME], fixed[MAX_ROW];
+	FILE *file = writer->out;
+	if (writer->column)
+	{
+		// Deleted rows have no partition
+		if (!len)
+			return 1;
+		if (!partition_name(row, writer->delim, writer->column, name) ||
+				!(file = writer_partition(writer, name)))
+			return 0;
+	}
+	if (writer->n_widths)
+	{
+		len = writer_fixed(writer, row, len, fixed);
+		row = fixed;
+	}
+	fwrite(row, 1, len, file);
+	return 1;
+}
+
+/**
+ * Push everything written so far out of the buffers
+ * @param writer_t *writer - writer to flush
+ */
+void writer_flush(writer_t *writer)
+{
+	if (writer->column)
+		fflush(NULL);
+	else
+		fflush(writer->out);
+}
+
+/**
+ * Close all partition files and free the partitions
+ * @param writer_t *writer - writer to close
+ * @return int - 1 if all files were written, 0 if error encountered
+ */
+int writer_close(writer_t *writer)
+{
+	int success = 1;
+	if (!writer->parts)
+		return 1;
+	for (long i = 0; i < writer->n_slots; i++)
+	{
+		if (writer->parts[i].file && fclose(writer->parts[i].file) == EOF)
+		{
+			fprintf(errs(), "Cannot write partition %s!\n",
+					writer->parts[i].name);
+			success = 0;
+		}
+	}
+	free(writer->parts);
+	writer->parts = NULL;
+	return success;
+}
+
+int irow_f(int no_cols, char *delim, writer_t *out)
+{
+	char temp[MAX_ROW];
+	create_empty_row(temp, no_cols, delim);
+	return writer_put(out, temp, strlen(temp));
+}
+
+int arow_f(int no_cols, char *delim, writer_t *out)
+{
+	char temp[MAX_ROW];
+	create_empty_row(temp, no_cols, delim);
+	return writer_put(out, temp, strlen(temp));
+}
+
+/**
+ * Call correct commands for table modifications of a single row
+ * @param pipeline_t *pl - pipeline of a program with mod commands
+ * @param char *row - row to modify, changed in place unless shared
+ * @param int shared - 1 if other pipelines still need the row as it is
+ * @param long n_row - number of the row
+ * @return int - 1 if success, 0 if error
+ */
+int mod_row(pipeline_t *pl, char *row, int shared, long n_row)
+{
+	user_args_t *user_args = pl->program->user_args;
+	int arg_i = pl->program->arg_no;
+	char *delim = pl->program->delim;
+	char out[MAX_ROW];
+	int deleted = 0, length;
+	// Mapped row is only changed by join
+	if (shared && (!pl->mapped || pl->joins))
+		row = strcpy(pl->row, row);
+	for (int i = 0; i < arg_i; i++)
+	{
+		int cmd_num = user_args[i].cmd_num;
+		int n_arg1 = user_args[i].num_args[0];
+		int n_arg2 = user_args[i].num_args[1];
+		if (pl->mapped && cmd_num != IROW && cmd_num != JOIN)
+		{
+			// Other column commands are done at once by col_map below
+			if ((cmd_num == DROW && n_arg1 == n_row) ||
+					(cmd_num == DROWS && n_arg1 <= n_row && n_arg2 >= n_row))
+				deleted = 1;
+			continue;
+		}
+		switch (cmd_num)
+		{
+			case IROW:
+				if (n_arg1 == n_row &&
+						!irow_f(pl->no_cols_adjusted, delim, &pl->writer))
+					return 0;
+				break;
+			case DROW:
+				if (n_arg1 == n_row)
+					drow_f(row);
+				break;
+			case DROWS:
+				if (n_arg1 <= n_row && n_arg2 >= n_row)
+					drow_f(row);
+				break;
+			case ICOL:
+				if (!icol_f(row, n_arg1, delim))
+					return 0;
+				break;
+			case ACOL:
+				if (!acol_f(row, delim))
+					return 0;
+				break;
+			case DCOL:
+				dcol_f(row, n_arg1, delim);
+				break;
+			case DCOLS:
+				dcols_f(row, n_arg1, n_arg2, delim);
+				break;
+			case JOIN:
+				if (deleted)
+					break;
+				if (!join_f(row, pl->mapped ? pl->key_col[i] : n_arg1,
+							user_args[i].table, pl->joined[i],
+							user_args[i].num_args[3], delim))
+					return 0;
+				break;
+		}
+	}
+	if (!pl->mapped)
+		return writer_put(&pl->writer, row, strlen(row));
+	// Join deletes the row when it finds no match
+	if (deleted || !row[0])
+		return 1;
+	index_columns(row, delim, &pl->cols);
+	length = gather_columns(row, &pl->cols, pl->col_map, pl->n_map,
+			delim[0], out);
+	if (length == TOO_LONG)
+	{
+		fprintf(errs(), "Line limit exceeded.\n");
+		return 0;
+	}
+	return writer_put(&pl->writer, out, length);
+}
+
+/**
+ * Check if arguments for the rows command are valid
+ * @param int arg1 - first line to select
+ * @param int arg2 - last line to select
+ * @param int dash1 - if to select from the beginning
+ * @param int dash2 - if to select until the end
+ * @return int - 1 if everything succeeded, 0 if error encountered
+ */
+int arg_check_rows(int arg1, int arg2, int dash1, int dash2)
+{
+	if (arg1 < 1 && !dash1)
+	{
+		fprintf(errs(), "Invalid row number: %d!\n", arg1);
+		return 0;
+	}
+	if (arg2 < 1 && !dash2)
+	{
+		fprintf(errs(), "Invalid row number: %d!\n", arg2);
+		return 0;
+	}
+	if (!(dash1 || dash2) && arg1 > arg2)
+	{
+		fprintf(errs(), "Invalid arguments: %d !<= %d\n", arg1, arg2);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Check column arguments of data and selection commands
+ * They only depend on the number of columns, so they are checked once per
+ * table instead of once for every row
+ * @param user_args_t *user_args - array of structs with called commands
+ * @param int arg_i - length of user_args array
+ * @param int no_cols - number of columns of the table
+ * @return int - 1 if all arguments are valid, 0 otherwise
+ */
+int data_args_check(user_args_t *user_args, int arg_i, int no_cols)
+{
+	for (int i = 0; i < arg_i; i++)
+	{
+		int n_arg1 = user_args[i].num_args[0];
+		int n_arg2 = user_args[i].num_args[1];
+		switch (user_args[i].cmd_num)
+		{
+			case COPY:
+			case SWAP:
+			case MOVE:
+				if (!col_arg_check(n_arg1, no_cols))
+					return 0;
+				if (!col_arg_check(n_arg2, no_cols))
+					return 0;
+				break;
+			case TOP:
+				if (!col_arg_check(n_arg2, no_cols))
+					return 0;
+				break;
+			case SAMPLE:
+			case EVERY:
+				break;
+			case ROWS:
+			case AND:
+			case OR:
+			case NOT:
+				break;	// rows is checked by row_args_check
+			default:
+				if (!col_arg_check(n_arg1, no_cols))
+					return 0;
+				break;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Fill skip with indexes from which to continue after a selection command
+ * did not select the row. Data commands in between cannot change an
+ * unselected row, so they are not visited at all
+ * @param user_args_t *user_args - array of structs with called commands
+ * @param int arg_i - length of user_args array
+ * @param int *skip - array of length arg_i to fill
+ */
+void selection_skips(user_args_t *user_args, int arg_i, int *skip)
+{
+	int next_selection = arg_i;
+	for (int i = arg_i - 1; i >= 0; i--)
+	{
+		// The loop increments after the skip, hence the - 1
+		skip[i] = next_selection - 1;
+		if (IS_SELECTION(user_args[i].cmd_num))
+			next_selection = i;
+	}
+}
+
+/**
+ * Return 1 if command is a term of selection, 0 if it is and, or, not
+ * @param int cmd_num - number of the command
+ * @return int - 1 if it is a selection term, 0 otherwise
+ */
+int is_selection_term(int cmd_num)
+{
+	return cmd_num == ROWS || cmd_num == BEGINSWITH || cmd_num == CONTAINS;
+}
+
+/**
+ * Return estimated cost of evaluating a selection term
+ * @param int cmd_num - number of the command
+ * @return int - relative cost, rows is the cheapest
+ */
+int selection_cost(int cmd_num)
+{
+	if (cmd_num == ROWS)
+		return 1;	// just compares numbers
+	else if (cmd_num == BEGINSWITH)
+		return 4;	// finds the column and compares a prefix
+	else
+		return 8;	// finds the column and scans all of it
+}
+
+/**
+ * Build the clauses of all selections of the program
+ * Terms in a clause start ordered from the cheapest, terms overwritten by a
+ * later selection without and / or are left out since they cannot change
+ * the result
+ * @param user_args_t *user_args - array of structs with called commands
+ * @param int arg_i - length of user_args array
+ * @param selection_plan_t *plan - plan with arrays of length arg_i to fill
+ */
+void selection_plan_init(user_args_t *user_args, int arg_i,
+		selection_plan_t *plan)
+{
+	int n_order = 0, n_clauses = 0;
+	for (int i = 0; i < arg_i; i++)
+	{
+		plan->tested[i] = plan->passed[i] = 0;
+		if (!IS_SELECTION(user_args[i].cmd_num) ||
+				(i > 0 && IS_SELECTION(user_args[i - 1].cmd_num)))
+			continue;
+
+		// i is the start of a selection, find its clauses
+		int start = i, clause = n_clauses;
+		for (; i < arg_i && IS_SELECTION(user_args[i].cmd_num); i++)
+		{
+			if (!is_selection_term(user_args[i].cmd_num))
+				continue;
+			if (user_args[i].join == JOIN_NONE)
+			{
+				// Everything before is overwritten by this term
+				if (n_clauses > clause)
+					n_order = plan->clauses[clause].first;
+				n_clauses = clause;
+			}
+			if (user_args[i].join != JOIN_AND)
+			{
+				plan->clauses[n_clauses].first = n_order;
+				plan->clauses[n_clauses].length = 0;
+				plan->clauses[n_clauses++].last = 0;
+			}
+			// Insert the term into its clause ordered by cost
+			clause_t *current = &plan->clauses[n_clauses - 1];
+			int j = current->first + current->length++;
+			int cost = selection_cost(user_args[i].cmd_num);
+			for (; j > current->first && selection_cost(
+						user_args[plan->order[j - 1]].cmd_num) > cost; j--)
+				plan->order[j] = plan->order[j - 1];
+			plan->order[j] = i;
+			n_order++;
+		}
+		plan->clauses[n_clauses - 1].last = 1;
+		plan->first_clause[start] = clause;
+		plan->end[start] = --i;
+	}
+	plan->n_clauses = n_clauses;
+}
+
+/**
+ * Reorder terms of every clause by their observed cost of rejecting a row
+ * Terms which are cheap and often reject a row go first, so the clause is
+ * decided evaluating as few terms as possible
+ * @param user_args_t *user_args - array of structs with called commands
+ * @param selection_plan_t *plan - plan with gathered statistics
+ */
+void selection_plan_adapt(user_args_t *user_args, selection_plan_t *plan)
+{
+	for (int c = 0; c < plan->n_clauses; c++)
+	{
+		int *order = plan->order + plan->clauses[c].first;
+		double rank[plan->clauses[c].length];
+		for (int j = 0; j < plan->clauses[c].length; j++)
+		{
+			int k = order[j];
+			double reject = plan->tested[k] ?
+				1.0 - (double) plan->passed[k] / plan->tested[k] : 0.0;
+			// Expected cost of reaching a rejection by this term
+			rank[j] = selection_cost(user_args[k].cmd_num) / (reject + 0.001);
+		}
+		for (int j = 1; j < plan->clauses[c].length; j++)
+		{
+			double r = rank[j];
+			int k = order[j], l = j;
+			for (; l > 0 && rank[l - 1] > r; l--)
+			{
+				rank[l] = rank[l - 1];
+				order[l] = order[l - 1];
+			}
+			rank[l] = r;
+			order[l] = k;
+		}
+	}
+}
+
+/**
+ * Return 1 if the term at index selects the row, 0 otherwise
+ */
+int selection_term(user_args_t *term, char *row, char *delim,
+		columns_t *cols, long n_row, int last_line)
+{
+	int selected = 0;
+	switch (term->cmd_num)
+	{
+		case ROWS:
+			selected = rows_f(n_row, term->num_args[0], term->num_args[1],
+					last_line, term->dash1, term->dash2);
+			break;
+		case BEGINSWITH:
+			selected = beginswith_f(row, term->num_args[0], term->str_arg,
+					delim, cols);
+			break;
+		case CONTAINS:
+			selected = contains_f(row, term->num_args[0], term->str_arg,
+					delim, cols);
+			break;
+	}
+	return selected != term->negate;
+}
+
+/**
+ * Evaluate the selection starting at index start, clauses are joined by or
+ * and their terms by and, both short circuit
+ * @return int - 1 if the row is selected, 0 otherwise
+ */
+int selection_eval(user_args_t *user_args, selection_plan_t *plan,
+		int start, char *row, char *delim, columns_t *cols, long n_row,
+		int last_line)
+{
+	for (int c = plan->first_clause[start]; ; c++)
+	{
+		int selected = 1;
+		int *order = plan->order + plan->clauses[c].first;
+		for (int j = 0; selected && j < plan->clauses[c].length; j++)
+		{
+			int k = order[j];
+			selected = selection_term(&user_args[k], row, delim, cols,
+					n_row, last_line);
+			plan->tested[k]++;
+			plan->passed[k] += selected;
+		}
+		if (selected)
+			return 1;
+		if (plan->clauses[c].last)
+			return 0;
+	}
+}
+
+/**
+ * Return 1 if a selection needs to know which row is the last one, which
+ * is only the case for rows - -
+ * @param user_args_t *user_args - array of structs with called commands
+ * @param int arg_i - length of user_args array
+ * @return int - 1 if the last row has to be known, 0 otherwise
+ */
+int needs_last_line(user_args_t *user_args, int arg_i)
+{
+	for (int i = 0; i < arg_i; i++)
+		if (user_args[i].cmd_num == ROWS && user_args[i].dash1 &&
+				user_args[i].dash2)
+			return 1;
+	return 0;
+}
+
+/**
+ * Return 1 if row a belongs before row b in the result of top
+ * @param top_t *top - top with the order
+ * @param top_entry_t *a - first row
+ * @param top_entry_t *b - second row
+ * @return int - 1 if a is better than b, 0 otherwise
+ */
+int top_better(top_t *top, top_entry_t *a, top_entry_t *b)
+{
+	int cmp;
+	if (top->type == ORDER_NUM)
+		cmp = (a->num > b->num) - (a->num < b->num);
+	else
+	{
+		int len = a->key_len < b->key_len ? a->key_len : b->key_len;
+		if (!(cmp = memcmp(a->row + a->key, b->row + b->key, len)))
+			cmp = (a->key_len > b->key_len) - (a->key_len < b->key_len);
+	}
+	if (top->order == ORDER_ASC)
+		cmp = -cmp;
+	return cmp > 0 || (cmp == 0 && a->seq < b->seq);
+}
+
+/**
+ * Move entry at index down the heap until both of its children are better
+ * @param top_t *top - top with the heap
+ * @param int index - index of the entry to move
+ * @param int n - amount of entries in the heap
+ */
+void top_sift_down(top_t *top, int index, int n)
+{
+	top_entry_t entry = top->heap[index];
+	for (int child; (child = 2 * index + 1) < n; index = child)
+	{
+		if (child + 1 < n &&
+				top_better(top, &top->heap[child], &top->heap[child + 1]))
+			child++;
+		if (!top_better(top, &entry, &top->heap[child]))
+			break;
+		top->heap[index] = top->heap[child];
+	}
+	top->heap[index] = entry;
+}
+
+/**
+ * Keep row if it is among the best top->k rows seen so far, the row is
+ * only copied once it beats the worst kept row
+ * Rows without a number in the key column are skipped when comparing
+ * numbers
+ * @param top_t *top - started top
+ * @param char *row - row to offer
+ * @param int len - length of row
+ * @param char *delim - string of delim characters
+ * @param columns_t *cols - offsets of columns of row
+ * @param long seq - number of the row
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int top_offer(top_t *top, char *row, int len, char *delim, columns_t *cols,
+		long seq)
+{
+	top_entry_t cand, *entry;
+	int start, end, index;
+	char cell[MAX_CELL], *endptr;
+	column_bounds(row, delim, cols, top->col, &start, &end);
+	cand.row = row;
+	cand.key = start;
+	cand.key_len = end == EMPTY_COL ? 0 : end - start + 1;
+	cand.seq = seq;
+	cand.num = 0;
+	if (top->type == ORDER_NUM)
+	{
+		if (!cand.key_len || cand.key_len >= MAX_CELL)
+			return 1;
+		memcpy(cell, row + start, cand.key_len);
+		cell[cand.key_len] = '\0';
+		cand.num = strtod(cell, &endptr);
+		if (*endptr)
+			return 1;
+	}
+	// Most rows are rejected by the worst kept one without any copy
+	if (top->n == top->k && !top_better(top, &cand, &top->heap[0]))
+		return 1;
+
+	index = top->n < top->k ? top->n++ : 0;
+	entry = &top->heap[index];
+	if (entry->size < len + 1)
+	{
+		char *copy = realloc(entry->row, len + 1);
+		if (!copy)
+		{
+			fprintf(errs(), "Not enough memory for top!\n");
+			return 0;
+		}
+		entry->row = copy;
+		entry->size = len + 1;
+	}
+	memcpy(entry->row, row, len + 1);
+	entry->len = len;
+	entry->key = cand.key;
+	entry->key_len = cand.key_len;
+	entry->num = cand.num;
+	entry->seq = seq;
+	if (index)
+	{
+		// New row moves up while it is worse than its parent
+		cand = *entry;
+		for (; index && top_better(top, &top->heap[(index - 1) / 2], &cand);
+				index = (index - 1) / 2)
+			top->heap[index] = top->heap[(index - 1) / 2];
+		top->heap[index] = cand;
+	}
+	else
+		top_sift_down(top, 0, top->n);
+	return 1;
+}
+
+/**
+ * Write the kept rows from the best one, the heap is sorted in place
+ * @param top_t *top - top which got all the rows
+ * @param writer_t *out - where to write the rows
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int top_write(top_t *top, writer_t *out)
+{
+	// Heap sort, the worst row goes to the back first
+	for (int n = top->n - 1; n > 0; n--)
+	{
+		top_entry_t worst = top->heap[0];
+		top->heap[0] = top->heap[n];
+		top->heap[n] = worst;
+		top_sift_down(top, 0, n);
+	}
+	for (int i = 0; i < top->n; i++)
+		if (!writer_put(out, top->heap[i].row, top->heap[i].len))
+			return 0;
+	return 1;
+}
+
+/**
+ * Return next random number, splitmix64 gives the same numbers everywhere
+ * so a seeded sample can be reproduced
+ * @param unsigned long long *state - state of the generator
+ * @return unsigned long long - random number
+ */
+unsigned long long random_next(unsigned long long *state)
+{
+	unsigned long long z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/**
+ * Return random number from the open interval (0, 1)
+ * @param unsigned long long *state - state of the generator
+ * @return double - random number
+ */
+double random_unit(unsigned long long *state)
+{
+	return ((random_next(state) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/**
+ * Take row if it is the next one to be sampled
+ * every writes every k-th row starting with the first one right away, sample
+ * keeps a reservoir of k rows, each row has the same chance to end up in it.
+ * Algorithm L tells how many rows to pass before the next one is taken, so
+ * rows in between cost nothing and can even be skipped by the reader
+ * @param sampler_t *sampler - started sampler
+ * @param char *row - row which got to the command
+ * @param int len - length of row
+ * @param long seq - number of the row
+ * @param writer_t *out - where every writes the rows
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int sampler_offer(sampler_t *sampler, char *row, int len, long seq,
+		writer_t *out)
+{
+	top_entry_t *entry;
+	double gap;
+	if (++sampler->seen != sampler->next)
+		return 1;
+	if (!sampler->rows)
+	{
+		sampler->next += sampler->k;
+		return writer_put(out, row, len);
+	}
+
+	if (sampler->n < sampler->k)
+		entry = &sampler->rows[sampler->n++];
+	else
+		entry = &sampler->rows[random_next(&sampler->state) % sampler->k];
+	if (entry->size < len + 1)
+	{
+		char *copy = realloc(entry->row, len + 1);
+		if (!copy)
+		{
+			fprintf(errs(), "Not enough memory for sample!\n");
+			return 0;
+		}
+		entry->row = copy;
+		entry->size = len + 1;
+	}
+	memcpy(entry->row, row, len + 1);
+	entry->len = len;
+	entry->seq = seq;
+
+	if (sampler->n < sampler->k)
+	{
+		sampler->next++;
+		return 1;
+	}
+	if (sampler->seen == sampler->k)
+		sampler->w = exp(log(random_unit(&sampler->state)) / sampler->k);
+	else
+		sampler->w *= exp(log(random_unit(&sampler->state)) / sampler->k);
+	gap = floor(log(random_unit(&sampler->state)) / log(1 - sampler->w));
+	if (gap >= LONG_MAX - sampler->next)
+		sampler->next = LONG_MAX;
+	else
+		sampler->next += (long) gap + 1;
+	return 1;
+}
+
+/**
+ * Compare two rows of the reservoir by their number for qsort
+ * @param const void *a - first row
+ * @param const void *b - second row
+ * @return int - negative if a was earlier, positive if later
+ */
+int sampler_cmp(const void *a, const void *b)
+{
+	long seq_a = ((const top_entry_t *) a)->seq;
+	long seq_b = ((const top_entry_t *) b)->seq;
+	return (seq_a > seq_b) - (seq_a < seq_b);
+}
+
+/**
+ * Write the rows of the reservoir in the order they came in
+ * @param sampler_t *sampler - sampler which got all the rows
+ * @param writer_t *out - where to write the rows
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int sampler_write(sampler_t *sampler, writer_t *out)
+{
+	qsort(sampler->rows, sampler->n, sizeof(top_entry_t), sampler_cmp);
+	for (long i = 0; i < sampler->n; i++)
+		if (!writer_put(out, sampler->rows[i].row, sampler->rows[i].len))
+			return 0;
+	return 1;
+}
+
+/**
+ * Pick fast paths of commands by the traits of the cells they got while
+ * sampling
+ * @param pipeline_t *pl - pipeline with sampled traits
+ */
+void schema_adapt(pipeline_t *pl)
+{
+	user_args_t *user_args = pl->program->user_args;
+	for (int i = 0; i < pl->program->arg_no; i++)
+	{
+		int cmd_num = user_args[i].cmd_num;
+		if ((cmd_num == ROUND || cmd_num == INT) && pl->traits[i].integer)
+			pl->traits[i].fast = FAST_INT;
+	}
+}
+
+/**
+ * Call correct commands for data manipulation of a single row
+ * Rows which no data command changed are written out as they were loaded
+ * @param pipeline_t *pl - pipeline of a program with data commands
+ * @param char *row - row to process, changed in place unless shared
+ * @param int row_len - length of row
+ * @param int shared - 1 if other pipelines still need the row as it is
+ * @param long n_row - number of the row
+ * @param int last_line - 1 if it is the last row, only known for rows - -
+ * @return int - 1 if success, 0 if error
+ */
+int data_row(pipeline_t *pl, char *row, int row_len, int shared, long n_row,
+		int last_line)
+{
+	user_args_t *user_args = pl->program->user_args;
+	int arg_i = pl->program->arg_no;
+	char *delim = pl->program->delim;
+	int selected = 1, changed = 0, offered = 1;
+	pl->cols.count = 0;
+	for (int i = 0; i < arg_i; i++)
+	{
+		int cmd_num = user_args[i].cmd_num;
+		int n_arg1 = user_args[i].num_args[0];
+		int n_arg2 = user_args[i].num_args[1];
+		char *str = user_args[i].str_arg;
+		// Unselected rows never get here, see skip
+		if (IS_DATA(cmd_num) && !IS_FINAL(cmd_num) && !changed)
+		{
+			// Copy on write, selections only read the row
+			if (shared)
+				row = memcpy(pl->row, row, row_len + 1);
+			changed = 1;
+		}
+		switch(cmd_num)
+		{
+			case CSET:
+				if (!cset_f(row, n_arg1, str, delim))
+					return 0;
+				break;
+			case TOLOWER:
+				tolower_f(row, n_arg1, delim, &pl->cols);
+				break;
+			case TOUPPER:
+				toupper_f(row, n_arg1, delim, &pl->cols);
+				break;
+			case ROUND:
+			case INT:
+				if (pl->traits && pl->traits[i].fast == FAST_INT)
+				{
+					// Row is not changed, so its columns stay indexed
+					if (int_cell(row, n_arg1, delim, &pl->cols))
+						continue;
+					// Other cells break the trait, but are still correct
+					pl->traits[i].fast = FAST_NONE;
+				}
+				else if (pl->traits && pl->seen < SCHEMA_ROWS &&
+						!int_cell(row, n_arg1, delim, &pl->cols))
+					pl->traits[i].integer = 0;
+				if (!cached_rounding_f(row, n_arg1, delim, cmd_num,
+							pl->cache_of[i], &pl->cols))
+					return 0;
+				break;
+			case COPY:
+				if (!copy_f(row, n_arg1, n_arg2, delim))
+					return 0;
+				break;
+			case SWAP:
+			case MOVE:
+				if (pl->run_end[i] != NOT_FOUND && !pl->cols.count)
+					index_columns(row, delim, &pl->cols);
+				// cset can add columns, the map is only good without them
+				if (pl->run_end[i] != NOT_FOUND &&
+						pl->cols.count == pl->no_cols)
+				{
+					// The whole run is a single permutation of columns
+					char out[MAX_ROW];
+					gather_columns(row, &pl->cols,
+							pl->run_map + i * pl->no_cols,
+							pl->no_cols, delim[0], out);
+					strcpy(row, out);
+					i = pl->run_end[i];
+				}
+				else if (cmd_num == SWAP)
+					swap_f(row, n_arg1, n_arg2, delim);
+				else if (!move_f(row, n_arg1, n_arg2, delim))
+					return 0;
+				break;
+			case TOP:
+				// Kept rows are written once the table ends
+				offered = top_offer(&pl->top, row,
+						changed ? (int) strlen(row) : row_len, delim,
+						&pl->cols, n_row);
+				break;
+			case SAMPLE:
+			case EVERY:
+				offered = sampler_offer(&pl->sampler, row,
+						changed ? (int) strlen(row) : row_len, n_row,
+						&pl->writer);
+				break;
+			default:
+				// Selection with nothing after it would not change a thing
+				if (pl->plan.end[i] != arg_i - 1)
+					selected = selection_eval(user_args, &pl->plan, i, row,
+							delim, &pl->cols, n_row, last_line);
+				i = pl->plan.end[i];
+				break;
+		}
+		// Other data commands can change where columns start
+		if (IS_DATA(cmd_num) && cmd_num != TOLOWER && cmd_num != TOUPPER)
+			pl->cols.count = 0;
+		if (!selected)
+			i = pl->skip[i];
+	}
+	// Counted apart from n_row, which a resumed or sharded table starts
+	// past the first row
+	pl->seen++;
+	if (pl->seen == ADAPT_ROWS)
+		selection_plan_adapt(user_args, &pl->plan);
+	if (pl->seen == SCHEMA_ROWS && pl->traits)
+		schema_adapt(pl);
+	// Only rows which got to top, sample or every are written, they are
+	// always the last command
+	if (pl->top.heap || pl->sampler.active)
+		return offered;
+	return writer_put(&pl->writer, row,
+			changed ? (int) strlen(row) : row_len);
+}
+
+/**
+ * Compose icol, acol, dcol, dcols and join of a mod program into col_map,
+ * output column i is column col_map[i] of the row extended by the columns
+ * of all joins, so the columns of a row are rebuilt by a single pass
+ * @param pipeline_t *pl - pipeline of a program with mod commands
+ * @param int no_cols - number of columns of the table
+ * @return int - 1 if the map is built, 0 if commands need to run one by one
+ */
+int column_plan(pipeline_t *pl, int no_cols)
+{
+	user_args_t *user_args = pl->program->user_args;
+	int *map = pl->col_map, n = no_cols, n_src = no_cols;
+	for (int i = 0; i < n; i++)
+		map[i] = i;
+	for (int i = 0; i < pl->program->arg_no; i++)
+	{
+		int n_arg1 = user_args[i].num_args[0];
+		int n_arg2 = user_args[i].num_args[1];
+		int added = 0;
+		switch (user_args[i].cmd_num)
+		{
+			case ICOL:
+			case ACOL:
+				if (user_args[i].cmd_num == ACOL)
+					n_arg1 = n + 1;
+				// Arguments past the current columns are left to icol_f
+				if (n_arg1 < 1 || n_arg1 > n + 1 || n + 1 >= MAX_ROW)
+					return 0;
+				memmove(map + n_arg1, map + n_arg1 - 1,
+						(n - n_arg1 + 1) * sizeof(int));
+				map[n_arg1 - 1] = EMPTY_COL;
+				n++;
+				break;
+			case DCOL:
+			case DCOLS:
+				if (user_args[i].cmd_num == DCOL)
+					n_arg2 = n_arg1;
+				// A row without columns is left to dcols_f as well
+				if (n_arg1 < 1 || n_arg2 > n || n_arg1 > n_arg2 ||
+						n_arg2 - n_arg1 + 1 == n)
+					return 0;
+				memmove(map + n_arg1 - 1, map + n_arg2,
+						(n - n_arg2) * sizeof(int));
+				n -= n_arg2 - n_arg1 + 1;
+				break;
+			case JOIN:
+				if (n_arg1 < 1 || n_arg1 > n || map[n_arg1 - 1] == EMPTY_COL)
+					return 0;
+				pl->key_col[i] = map[n_arg1 - 1] + 1;
+				added = user_args[i].table->no_cols;
+				if (n + added >= MAX_ROW)
+					return 0;
+				for (int j = 0; j < added; j++)
+					map[n++] = n_src++;
+				break;
+		}
+	}
+	pl->n_map = n;
+	return 1;
+}
+
+/**
+ * Compose every run of swap and move commands into a single permutation
+ * of columns, see run_end and run_map of pipeline_t
+ * @param pipeline_t *pl - pipeline of a program with data commands
+ * @param int no_cols - number of columns of the table
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int column_runs(pipeline_t *pl, int no_cols)
+{
+	user_args_t *user_args = pl->program->user_args;
+	int arg_i = pl->program->arg_no, runs = 0;
+	for (int i = 0; i < arg_i; i++)
+		runs += pl->run_end[i] != NOT_FOUND;
+	if (!runs)
+		return 1;
+	if (!(pl->run_map = malloc(arg_i * no_cols * sizeof(int))))
+	{
+		fprintf(errs(), "Not enough memory!\n");
+		return 0;
+	}
+	for (int i = 0; i < arg_i; i++)
+	{
+		int *map = pl->run_map + i * no_cols;
+		if (pl->run_end[i] == NOT_FOUND)
+			continue;
+		for (int j = 0; j < no_cols; j++)
+			map[j] = j;
+		for (int j = i; j <= pl->run_end[i]; j++)
+		{
+			int from = user_args[j].num_args[0] - 1;
+			int to = user_args[j].num_args[1] - 1;
+			int col = map[from];
+			if (user_args[j].cmd_num == SWAP)
+			{
+				map[from] = map[to];
+				map[to] = col;
+				continue;
+			}
+			// move puts the column in front of column to
+			if (from < to)
+				to--;
+			if (from < to)
+				memmove(map + from, map + from + 1, (to - from) * sizeof(int));
+			else
+				memmove(map + to + 1, map + to, (from - to) * sizeof(int));
+			map[to] = col;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Prepare pipeline to run program over a table, pipeline has to be zeroed
+ * and closed by pipeline_close even if this fails
+ * @param pipeline_t *pl - zeroed pipeline
+ * @param const program_t *program - program to run
+ * @param FILE *out - stream to write to, unless program has its own output
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int pipeline_open(pipeline_t *pl, const program_t *program, FILE *out)
+{
+	cmd_types_t cmd_types = program->cmd_types;
+	user_args_t *user_args = program->user_args;
+	int arg_i = program->arg_no, n_caches = 0;
+	pl->program = program;
+	if (cmd_types.mod && (cmd_types.data || cmd_types.selection))
+	{
+		fprintf(errs(), "Unexpected combination of commands!\n");
+		return 0;
+	}
+	if (program->then_output)
+	{
+		if (!(out = open_table(program->then_output, "wb", program->level)))
+			return 0;
+		setvbuf(out, NULL, _IOFBF, WRITE_BLOCK);
+	}
+	if (!writer_init(&pl->writer, program, out))
+		return 0;
+	if (cmd_types.mod)
+	{
+		for (int i = 0; i < arg_i; i++)
+			pl->joins += user_args[i].cmd_num == JOIN;
+		if (!(pl->key_col = malloc(arg_i * sizeof(int))) ||
+				!(pl->joined = calloc(arg_i, sizeof(FILE *))))
+		{
+			fprintf(errs(), "Not enough memory!\n");
+			return 0;
+		}
+		// Lookups move the stream, so it is not shared with other pipelines
+		for (int i = 0; i < arg_i; i++)
+			if (user_args[i].cmd_num == JOIN && user_args[i].table->path &&
+					!(pl->joined[i] = open_file(user_args[i].table->path,
+							"rb")))
+				return 0;
+	}
+	if (!cmd_types.data && !cmd_types.selection)
+		return 1;
+
+	// Every round and int gets its own cache
+	for (int i = 0; i < arg_i; i++)
+		if (user_args[i].cmd_num == ROUND || user_args[i].cmd_num == INT)
+			n_caches++;
+	pl->skip = malloc(arg_i * sizeof(int));
+	pl->plan.order = malloc(arg_i * sizeof(int));
+	pl->plan.clauses = malloc(arg_i * sizeof(clause_t));
+	pl->plan.first_clause = malloc(arg_i * sizeof(int));
+	pl->plan.end = malloc(arg_i * sizeof(int));
+	pl->plan.tested = malloc(arg_i * sizeof(long));
+	pl->plan.passed = malloc(arg_i * sizeof(long));
+	pl->cache_of = malloc(arg_i * sizeof(cell_cache_t *));
+	pl->caches = n_caches ? calloc(n_caches, sizeof(cell_cache_t)) : NULL;
+	pl->run_end = malloc(arg_i * sizeof(int));
+	pl->traits = program->adaptive ? malloc(arg_i * sizeof(column_traits_t))
+		: NULL;
+	if (!pl->skip || !pl->plan.order || !pl->plan.clauses ||
+			!pl->plan.first_clause || !pl->plan.end || !pl->plan.tested ||
+			!pl->plan.passed || !pl->cache_of || (n_caches && !pl->caches) ||
+			!pl->run_end || (program->adaptive && !pl->traits))
+	{
+		fprintf(errs(), "Not enough memory!\n");
+		return 0;
+	}
+	for (int i = 0, j = 0; i < arg_i; i++)
+		if (user_args[i].cmd_num == ROUND || user_args[i].cmd_num == INT)
+			pl->cache_of[i] = &pl->caches[j++];
+	// Every trait holds until a sampled cell breaks it
+	for (int i = 0; pl->traits && i < arg_i; i++)
+	{
+		pl->traits[i].integer = 1;
+		pl->traits[i].fast = FAST_NONE;
+	}
+	for (int i = 0; i < arg_i; i++)
+	{
+		int j = i;
+		pl->run_end[i] = NOT_FOUND;
+		if (i && (user_args[i - 1].cmd_num == SWAP ||
+					user_args[i - 1].cmd_num == MOVE))
+			continue;
+		while (j < arg_i && (user_args[j].cmd_num == SWAP ||
+					user_args[j].cmd_num == MOVE))
+			j++;
+		if (j > i)
+			pl->run_end[i] = j - 1;
+	}
+	selection_skips(user_args, arg_i, pl->skip);
+	selection_plan_init(user_args, arg_i, &pl->plan);
+	// top is always the last command
+	if (user_args[arg_i - 1].cmd_num == TOP)
+	{
+		top_t *top = &pl->top;
+		top->k = user_args[arg_i - 1].num_args[0];
+		top->col = user_args[arg_i - 1].num_args[1];
+		top->type = user_args[arg_i - 1].num_args[2];
+		top->order = user_args[arg_i - 1].num_args[3];
+		if (!(top->heap = calloc(top->k, sizeof(top_entry_t))))
+		{
+			fprintf(errs(), "Not enough memory for top!\n");
+			return 0;
+		}
+	}
+	if (user_args[arg_i - 1].cmd_num == SAMPLE ||
+			user_args[arg_i - 1].cmd_num == EVERY)
+	{
+		sampler_t *sampler = &pl->sampler;
+		sampler->active = 1;
+		sampler->k = user_args[arg_i - 1].num_args[0];
+		sampler->state = user_args[arg_i - 1].num_args[1];
+		sampler->next = 1;
+		if (user_args[arg_i - 1].cmd_num == SAMPLE &&
+				!(sampler->rows = calloc(sampler->k, sizeof(top_entry_t))))
+		{
+			fprintf(errs(), "Not enough memory for sample!\n");
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Check arguments of the commands once the number of columns is known
+ * @param pipeline_t *pl - opened pipeline
+ * @param int no_cols - number of columns of the table
+ * @return int - 1 if all arguments are valid, 0 otherwise
+ */
+int pipeline_start(pipeline_t *pl, int no_cols)
+{
+	const program_t *program = pl->program;
+	pl->no_cols = pl->no_cols_adjusted = no_cols;
+	if (program->cmd_types.mod)
+		pl->no_cols_adjusted = no_cols_adjust(no_cols, program->user_args,
+				program->arg_no);
+	if (pl->writer.n_widths && pl->writer.n_widths != pl->no_cols_adjusted)
+	{
+		fprintf(errs(), "Expected %d widths for --fixed-output!\n",
+				pl->no_cols_adjusted);
+		return 0;
+	}
+	if (program->cmd_types.mod)
+	{
+		if (!mod_args_check(program->user_args, program->arg_no, no_cols))
+			return 0;
+		pl->mapped = column_plan(pl, no_cols);
+		return 1;
+	}
+	if (program->cmd_types.data || program->cmd_types.selection)
+		return data_args_check(program->user_args, program->arg_no, no_cols) &&
+			column_runs(pl, no_cols);
+	return 1;
+}
+
+/**
+ * Run commands of the pipeline over a single row and write it out
+ * @param pipeline_t *pl - started pipeline
+ * @param char *row - row to process
+ * @param int row_len - length of row
+ * @param int shared - 1 if other pipelines still need the row as it is
+ * @param long n_row - number of the row
+ * @param int last_line - 1 if it is the last row, only known for rows - -
+ * @return int - 1 if success, 0 if error
+ */
+int pipeline_row(pipeline_t *pl, char *row, int row_len, int shared,
+		long n_row, int last_line)
+{
+	cmd_types_t cmd_types = pl->program->cmd_types;
+	if (cmd_types.mod)
+		return mod_row(pl, row, shared, n_row);
+	if (cmd_types.data || cmd_types.selection)
+		return data_row(pl, row, row_len, shared, n_row, last_line);
+	return writer_put(&pl->writer, row, row_len);
+}
+
+/**
+ * Skip the following rows the pipeline would pass without looking at
+ * them, which is only known when sample or every is its only command,
+ * skipped rows are counted as seen
+ * @param pipeline_t *pl - started pipeline
+ * @param reader_t *reader - reader to skip rows of
+ * @param int no_cols - number of columns of the table
+ * @return long - amount of skipped rows
+ */
+long pipeline_skip(pipeline_t *pl, reader_t *reader, int no_cols)
+{
+	long skip;
+	if (!pl->sampler.active || pl->program->arg_no != 1)
+		return 0;
+	skip = reader_skip(reader, pl->sampler.next - pl->sampler.seen - 1,
+			no_cols);
+	pl->sampler.seen += skip;
+	return skip;
+}
+
+/**
+ * Write rows added after the end of the table
+ * @param pipeline_t *pl - pipeline which got all the rows
+ * @return int - 1 if success, 0 if error
+ */
+int pipeline_end(pipeline_t *pl)
+{
+	user_args_t *user_args = pl->program->user_args;
+	if (pl->top.heap)
+		return top_write(&pl->top, &pl->writer);
+	if (pl->sampler.rows)
+		return sampler_write(&pl->sampler, &pl->writer);
+	if (!pl->program->cmd_types.mod)
+		return 1;
+	for (int i = 0; i < pl->program->arg_no; i++)
+		if (user_args[i].cmd_num == AROW &&
+				!arow_f(pl->no_cols_adjusted, pl->program->delim, &pl->writer))
+			return 0;
+	return 1;
+}
+
+/**
+ * Free everything pipeline_open allocated and close its own output
+ * @param pipeline_t *pl - pipeline to close
+ * @return int - 1 if all of the output was written, 0 if error encountered
+ */
+int pipeline_close(pipeline_t *pl)
+{
+	int success = writer_close(&pl->writer);
+	free(pl->skip);
+	free(pl->plan.order);
+	free(pl->plan.clauses);
+	free(pl->plan.first_clause);
+	free(pl->plan.end);
+	free(pl->plan.tested);
+	free(pl->plan.passed);
+	free(pl->cache_of);
+	free(pl->caches);
+	free(pl->key_col);
+	for (int i = 0; pl->joined && i < pl->program->arg_no; i++)
+		if (pl->joined[i])
+			fclose(pl->joined[i]);
+	free(pl->joined);
+	free(pl->run_end);
+	free(pl->run_map);
+	free(pl->traits);
+	for (int i = 0; pl->top.heap && i < pl->top.k; i++)
+		free(pl->top.heap[i].row);
+	free(pl->top.heap);
+	for (int i = 0; pl->sampler.rows && i < pl->sampler.k; i++)
+		free(pl->sampler.rows[i].row);
+	free(pl->sampler.rows);
+	if (pl->program && pl->program->then_output && pl->writer.out &&
+			fclose(pl->writer.out) == EOF)
+	{
+		fprintf(errs(), "Cannot write file %s!\n", pl->program->then_output);
+		success = 0;
+	}
+	return success;
+}
+
+/**
+ * Read the table once and feed every row to all of the pipelines
+ * @param pipeline_t *pls - opened pipelines, the first one decides follow
+ * and checkpoint
+ * @param int n_pls - length of pls array
+ * @param FILE *in - stream to read the table from
+ * @return int - 1 if success, 0 if error
+ */
+int process_pipelines(pipeline_t *pls, int n_pls, FILE *in)
+{
+	const program_t *program = pls[0].program;
+	// The two buffers take turns, so the loaded line never has to be copied
+	char buf_row[MAX_ROW], buf_next[MAX_ROW];
+	char *row = buf_row, *next = buf_next, *swap;
+	long n_row, first_row;
+	int init = 0;
+	int no_cols = 0;
+	int last_line = 0, line_ret;
+	int row_cols;	// number of columns of row, reader holds the one of next
+	int row_len;	// length of row
+	// Only rows - - needs to know if the row is the last one, otherwise
+	// rows are processed without waiting for the next one
+	int look_ahead = 0;
+	for (int p = 0; p < n_pls; p++)
+		look_ahead |= needs_last_line(pls[p].program->user_args,
+				pls[p].program->arg_no);
+	// Without commands rows are only validated, which reader_pass does
+	// in whole blocks once the number of columns is known
+	int pass = n_pls == 1 && !program->arg_no && !program->checkpoint &&
+		!program->follow && !program->partition_by && !program->fixed_input &&
+		!program->fixed_output && !program->shards && !program->range_end;
+	reader_t reader;
+	reader_init(&reader, in, program);
+	if (program->shards || program->range_end)
+		n_row = reader_range(&reader, program);
+	else
+		n_row = checkpoint_resume(program, &reader, pls[0].writer.out);
+	if (n_row == NOT_FOUND)
+		return 0;
+	first_row = n_row + 1;
+	line_ret = load_line(&reader, next);
+	while (line_ret)
+	{
+		swap = row;
+		row = next;
+		next = swap;
+		row_cols = reader.no_cols;
+		row_len = line_ret;
+		if (look_ahead)
+		{
+			line_ret = load_line(&reader, next);
+			// When last line
+			if (!line_ret)
+				last_line = 1;
+		}
+		n_row++;
+		if (!init)
+		{
+			no_cols = row_cols;
+			for (int p = 0; p < n_pls; p++)
+				if (!pipeline_start(&pls[p], no_cols))
+					return 0;
+			init = 1;
+		}
+		if (!process_error_handling(row_cols, no_cols,
+					row_len == TOO_LONG ? TOO_LONG : line_ret))
+			return 0;
+		// The last pipeline is free to change the row in place
+		for (int p = 0; p < n_pls; p++)
+			if (!pipeline_row(&pls[p], row, row_len, p < n_pls - 1, n_row,
+						last_line))
+				return 0;
+		if (program->follow)
+			for (int p = 0; p < n_pls; p++)
+				writer_flush(&pls[p].writer);
+		// The next line is already loaded when looking ahead
+		if (!checkpoint_save(program, &reader, pls[0].writer.out, n_row,
+					look_ahead ? line_ret : 0))
+			return 0;
+		if (!look_ahead)
+		{
+			// Rows a lone pipeline would pass are not even loaded, they are
+			// only checked in place
+			if (n_pls == 1 && !program->checkpoint)
+				n_row += pipeline_skip(&pls[0], &reader, no_cols);
+			if (pass)
+				n_row += reader_pass(&reader, pls[0].writer.out, no_cols,
+						LONG_MAX);
+			line_ret = load_line(&reader, next);
+		}
+	}
+	if (reader.error)
+		return 0;
+	if (!init && reader.end == LONG_MAX &&
+			(program->shards || program->range_end))
+	{
+		// The last shard got no row, but arow still needs the width of the
+		// table, which the first row of the file has
+		reader_init(&reader, in, program);
+		if (!fseek(in, 0, SEEK_SET) && load_line(&reader, next) > 0)
+			for (int p = 0; p < n_pls; p++)
+				if (!pipeline_start(&pls[p], reader.no_cols))
+					return 0;
+	}
+
+	// Handling AROW must happen after the end of stdin, only the last shard
+	// gets to the end
+	for (int p = 0; reader.end == LONG_MAX && p < n_pls; p++)
+		if (!pipeline_end(&pls[p]))
+			return 0;
+	if (program->shards || program->range_end)
+		return shard_save(program, first_row, n_row - first_row + 1);
+	return 1;
+}
+
+/*
+ * Run the program and all the programs chained to it by --then-output over
+ * a table, the table is read and split into rows only once
+ * The program is only read, all of the state lives in the pipelines of this
+ * call, so it is safe to call repeatedly or from more threads
+ * @param const program_t *program - commands loaded by load_program
+ * @param FILE *in - stream to read the table from, files in program->chain
+ * are read after it as a part of the same table
+ * @param FILE *out - stream to write the result to, unused when the rows
+ * are partitioned into program->out_dir
+ * @return int - 1 if everything succeeded, 0 if error encountered
+ */
+int handle_commands(const program_t *program, FILE *in, FILE *out)
+{
+	pipeline_t *pls;
+	int n_pls = 0, success = 1;
+	for (const program_t *p = program; p; p = p->then)
+		n_pls++;
+	// Pipelines are too big for the stack
+	if (!(pls = calloc(n_pls, sizeof(pipeline_t))))
+	{
+		fprintf(errs(), "Not enough memory!\n");
+		return 0;
+	}
+	for (int p = 0; success && p < n_pls; p++, program = program->then)
+		success = pipeline_open(&pls[p], program, out);
+	if (success)
+		success = process_pipelines(pls, n_pls, in);
+	for (int p = 0; p < n_pls; p++)
+		if (!pipeline_close(&pls[p]))
+			success = 0;
+	free(pls);
+	return success;
+}
+
+
+/**
+ * Check if it is a valid string argument
+ * valid string arguments are either arg #2 for cset 
+ * or - for rows or arg #2 for beginswith or the file for join
+ * @param char *argv - arugment to check
+ * @param int cmd_num - number of command called
+ * @param int index - index of num_arg inside the user_args_t struct
+ * @param user_args_t *users_args - array of user arguments
+ * @return 1 if it is a valid string arugment, 0 otherwise
+ * set dash1 or dash2 if called with rows
+ */
+int valid_str_arg(char *argv, int cmd_num, int index,
+		user_args_t *user_args)
+{
+	if(cmd_num == CSET && index == 1)
+		return 1;
+	if(cmd_num == BEGINSWITH && index == 1)
+		return 1;
+	if(cmd_num == CONTAINS && index == 1)
+		return 1;
+	if(cmd_num == JOIN && index == 1)
+		return 1;
+	if(cmd_num == ROWS && (strcmp("-", argv) == 0))
+	{
+		if (index == 0)
+			user_args->dash1 = 1;
+		if (index == 1)
+			user_args->dash2 = 1;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Check if it is a valid number argument
+ * @param char *argv - arugment to check
+ * @param int index - index of num_arg inside the user_args_t struct
+ * @param user_args_t *users_args - array of user arguments
+ * @return 1 if it is a valid number arugment, 0 otherwise
+ */
+int valid_num_arg(char *argv, int index, user_args_t *user_args)
+{
+	char *endptr, function_name[LENGTH_NAME];
+	int cmd_num = user_args->cmd_num;
+	user_args->num_args[index] = strtol(argv, &endptr, 10);
+	if (*endptr)
+	{
+		strcpy(function_name, commands_s[cmd_num].name);
+		fprintf(
+			errs(),
+			"Invalid argument %s for command %s.\nNumber expected\n",
+			endptr, function_name);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Loads user arguments for a command with cmd_num into user_args
+ * @param char **argv - passing command line arguments
+ * @param int *user_args - pointer to user_args structure to load information
+ * @param char *str - argument for cset
+ * @return int 1 if everything went well, 0 otherwise
+ */
+int load_command_user_args(char **argv, user_args_t *user_args)
+{
+	int cmd_num = user_args->cmd_num;
+	int i, no_args = commands_s[cmd_num].no_args;
+	char function_name[LENGTH_NAME];
+	user_args->dash1 = user_args->dash2 = 0;
+	for (i = 0; i < no_args; i++)
+	{
+		if (*++argv)
+		{
+			if (valid_str_arg(*argv, cmd_num, i, user_args))
+			{
+				if (strlen(*argv) >= MAX_CELL)
+				{
+					fprintf(errs(), "Argument %s too long.\n", *argv);
+					return 0;
+				}
+				strcpy(user_args->str_arg, *argv);
+			}
+			else if (!valid_num_arg(*argv, i, user_args))
+				return 0;
+		}
+		else
+		{
+			strcpy(function_name, commands_s[cmd_num].name);
+			fprintf(errs(), "Invalid amount of arguments for command %s\n",
+					function_name);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Check row arguments of all commands, they do not depend on the table so
+ * they are checked only once when the program is loaded
+ * @param user_args_t *user_args - array of structs with called commands
+ * @param int arg_i - length of user_args array
+ * @return int - 1 if all arguments are valid, 0 otherwise
+ */
+int row_args_check(user_args_t *user_args, int arg_i)
+{
+	for (int i = 0; i < arg_i; i++)
+	{
+		int n_arg1 = user_args[i].num_args[0];
+		int n_arg2 = user_args[i].num_args[1];
+		switch (user_args[i].cmd_num)
+		{
+			case IROW:
+			case DROW:
+				if (!row_arg_check(n_arg1))
+					return 0;
+				break;
+			case DROWS:
+				if (!(row_arg_check(n_arg1) && row_arg_check(n_arg2)))
+					return 0;
+				if (!two_arg_check(n_arg1, n_arg2))
+					return 0;
+				break;
+			case ROWS:
+				if (!arg_check_rows(n_arg1, n_arg2, user_args[i].dash1,
+							user_args[i].dash2))
+					return 0;
+				break;
+			case TOP:
+			case SAMPLE:
+			case EVERY:
+				if (n_arg1 <= 0)
+				{
+					fprintf(errs(), "Invalid amount of rows: %d!\n", n_arg1);
+					return 0;
+				}
+				break;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Resolve not, and, or of selections into negate and join of their terms
+ * Terms following each other without and / or keep the original meaning,
+ * the later one overwrites the earlier
+ * @param user_args_t *user_args - array of structs with called commands
+ * @param int arg_i - length of user_args array
+ * @return int - 1 if all selections are well formed, 0 otherwise
+ */
+int load_selections(user_args_t *user_args, int arg_i)
+{
+	int negate = 0, join = JOIN_NONE, after_term = 0;
+	for (int i = 0; i <= arg_i; i++)
+	{
+		int cmd_num = i < arg_i ? user_args[i].cmd_num : NOT_FOUND;
+		if (cmd_num == AND || cmd_num == OR)
+		{
+			if (!after_term)
+			{
+				fprintf(errs(), "Invalid use of %s!\n",
+						commands_s[cmd_num].name);
+				return 0;
+			}
+			join = cmd_num == AND ? JOIN_AND : JOIN_OR;
+			after_term = 0;
+		}
+		else if (cmd_num == NOT)
+		{
+			negate = !negate;
+			after_term = 0;
+		}
+		else if (cmd_num != NOT_FOUND && is_selection_term(cmd_num))
+		{
+			user_args[i].negate = negate;
+			user_args[i].join = join;
+			negate = 0;
+			join = JOIN_NONE;
+			after_term = 1;
+		}
+		else
+		{
+			// Selection ended, it must not end with and, or, not
+			if (negate || join != JOIN_NONE)
+			{
+				fprintf(errs(), "Selection term expected after %s!\n",
+						commands_s[user_args[i - 1].cmd_num].name);
+				return 0;
+			}
+			after_term = 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Return FNV-1a hash of size bytes of data continuing from hash
+ * @param unsigned hash - hash of the preceding data
+ * @param const void *data - data to hash
+ * @param size_t size - amount of bytes to hash
+ * @return unsigned - hash of the preceding data and data
+ */
+unsigned hash_bytes(unsigned hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = data;
+	while (size--)
+		hash = (hash ^ *bytes++) * 16777619u;
+	return hash;
+}
+
+/**
+ * Return hash of everything that determines the output of the program
+ * @param const program_t *program - program with user_args and delim set
+ * @return unsigned - hash of the program
+ */
+unsigned program_hash(const program_t *program)
+{
+	unsigned hash = hash_bytes(2166136261u, program->delim,
+			strlen(program->delim) + 1);
+	for (int i = 0; i < program->arg_no; i++)
+	{
+		user_args_t *args = &program->user_args[i];
+		hash = hash_bytes(hash, &args->cmd_num, sizeof(args->cmd_num));
+		hash = hash_bytes(hash, args->num_args, sizeof(args->num_args));
+		hash = hash_bytes(hash, args->str_arg, strlen(args->str_arg) + 1);
+		hash = hash_bytes(hash, &args->dash1, sizeof(args->dash1));
+		hash = hash_bytes(hash, &args->dash2, sizeof(args->dash2));
+	}
+	if (program->fixed_output)
+		hash = hash_bytes(hash, program->fixed_output,
+				strlen(program->fixed_output) + 1);
+	return hash;
+}
+
+/**
+ * Check that file can be read or written as a table of program, compressed
+ * files are only read and written from their start to their end
+ * @param char *file - -i, -o or --then-output file
+ * @param const program_t *program - program with all options loaded
+ * @return int - 1 if it can, 0 otherwise
+ */
+int compression_check(char *file, const program_t *program)
+{
+	if (is_compressed(file, ".zst"))
+	{
+		fprintf(errs(), "Cannot use %s, only .gz files are compressed!\n",
+				file);
+		return 0;
+	}
+	if (is_compressed(file, ".gz") && (program->follow || program->resume ||
+				program->checkpoint || program->shards || program->range_end ||
+				program->merge))
+	{
+		fprintf(errs(), "Compressed %s cannot be used with --follow, "
+				"--checkpoint, --shard, --byte-range or --merge!\n", file);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Load the delimiter, files and all commands with their arguments into
+ * program. More inputs are read as one table with rows numbered across
+ * them, unless each of them has its own output, then every input is a
+ * separate table. Commands after --then-output FILE form another program
+ * run over the same read of the table, chained to the previous one by then
+ * Files after -i and -o end at the first option or command, a file named
+ * like one of them or starting with '-' has to be given as ./NAME
+ * @param char **argv - command line arguments, argv[0] is skipped
+ * @param user_args_t *user_args - array long enough for all the commands
+ * @param char **inputs - array long enough for all the input files
+ * @param char **outputs - array long enough for all the output files
+ * @param program_t *program - array long enough for all the programs, the
+ * first one is where options are loaded to
+ * @return int - 1 if everything went well, 0 otherwise
+ */
+int load_program(char **argv, user_args_t *user_args, char **inputs,
+		char **outputs, program_t *program)
+{
+	int arg_i = 0, n_inputs = 0, n_outputs = 0, first = 0, delim_given = 0;
+	int widths[MAX_FIXED];
+	cmd_types_t cmd_types = { 0, 0, 0 };
+	program_t *current = program;
+	program->delim = " ";
+	program->follow = program->resume = 0;
+	program->checkpoint = NULL;
+	program->partition_by = 0;
+	program->out_dir = NULL;
+	program->then_output = NULL;
+	program->shard = program->shards = program->first_row = 0;
+	program->range_start = program->range_end = 0;
+	program->merge = 0;
+	program->fixed_input = program->fixed_output = NULL;
+	program->adaptive = 0;
+	program->level = GZ_LEVEL;
+
+	while (*++argv)
+	{
+		if (strcmp(*argv, "-d") == 0)
+		{
+			if (*++argv)
+			{
+				program->delim = *argv;
+				delim_given = 1;
+			}
+			else
+			{
+				fprintf(errs(), "Delimiter not given!\n");
+				return 0;
+			}
+		}
+		else if (strcmp(*argv, "--shard") == 0 ||
+				strcmp(*argv, "--byte-range") == 0)
+		{
+			// I/N for --shard, START:END for --byte-range
+			char *option = *argv, *endptr = NULL, sep = option[2] == 's' ?
+				'/' : ':';
+			long first = 0, second = 0;
+			if (*++argv)
+			{
+				first = strtol(*argv, &endptr, 10);
+				if (*endptr == sep)
+					second = strtol(endptr + 1, &endptr, 10);
+			}
+			if (!endptr || *endptr || first < 0 || first > second ||
+					(sep == ':' && first == second) ||
+					(sep == '/' && (!first || second > INT_MAX)))
+			{
+				fprintf(errs(), "Invalid range for %s!\n", option);
+				return 0;
+			}
+			if (sep == '/')
+			{
+				program->shard = first;
+				program->shards = second;
+			}
+			else
+			{
+				program->range_start = first;
+				program->range_end = second;
+			}
+		}
+		else if (strcmp(*argv, "--first-row") == 0)
+		{
+			char *endptr = NULL;
+			if (*++argv)
+				program->first_row = strtol(*argv, &endptr, 10);
+			if (!endptr || *endptr || program->first_row <= 0)
+			{
+				fprintf(errs(), "Invalid row for --first-row!\n");
+				return 0;
+			}
+		}
+		else if (strcmp(*argv, "--merge") == 0)
+			program->merge = 1;
+		else if (strcmp(*argv, "--adaptive") == 0)
+			program->adaptive = 1;
+		else if (strcmp(*argv, "--fixed") == 0 ||
+				strcmp(*argv, "--fixed-input") == 0 ||
+				strcmp(*argv, "--fixed-output") == 0)
+		{
+			// --fixed is for both input and output
+			char *option = *argv;
+			if (!*++argv || !load_widths(*argv, widths))
+			{
+				fprintf(errs(), "Invalid widths for %s!\n", option);
+				return 0;
+			}
+			if (strcmp(option, "--fixed-output") != 0)
+				program->fixed_input = *argv;
+			if (strcmp(option, "--fixed-input") != 0)
+				program->fixed_output = *argv;
+		}
+		else if (strcmp(*argv, "--follow") == 0)
+			program->follow = 1;
+		else if (strcmp(*argv, "--resume") == 0)
+			program->resume = 1;
+		else if (strcmp(*argv, "--checkpoint") == 0)
+		{
+			if (*++argv)
+				program->checkpoint = *argv;
+			else
+			{
+				fprintf(errs(), "Checkpoint file not given!\n");
+				return 0;
+			}
+		}
+		else if (strcmp(*argv, "--partition-by") == 0)
+		{
+			char *endptr = NULL;
+			if (*++argv)
+				program->partition_by = strtol(*argv, &endptr, 10);
+			if (!endptr || *endptr || program->partition_by <= 0)
+			{
+				fprintf(errs(), "Invalid column for --partition-by!\n");
+				return 0;
+			}
+		}
+		else if (strcmp(*argv, "--level") == 0)
+		{
+			char *endptr = NULL;
+			if (*++argv)
+				program->level = strtol(*argv, &endptr, 10);
+			if (!endptr || *endptr || program->level < 0 ||
+					program->level > 9)
+			{
+				fprintf(errs(), "Expected compression level 0 to 9!\n");
+				return 0;
+			}
+		}
+		else if (strcmp(*argv, "--out-dir") == 0)
+		{
+			if (*++argv)
+				program->out_dir = *argv;
+			else
+			{
+				fprintf(errs(), "Directory for --out-dir not given!\n");
+				return 0;
+			}
+		}
+		else if (strcmp(*argv, "--then-output") == 0)
+		{
+			if (!*++argv)
+			{
+				fprintf(errs(), "File for --then-output not given!\n");
+				return 0;
+			}
+			// Commands loaded so far belong to the previous program
+			current->user_args = user_args + first;
+			current->arg_no = arg_i - first;
+			current->cmd_types = cmd_types;
+			current->then = current + 1;
+			current++;
+			memset(current, 0, sizeof(program_t));
+			current->then_output = *argv;
+			first = arg_i;
+			cmd_types.mod = cmd_types.data = cmd_types.selection = 0;
+		}
+		else if (strcmp(*argv, "-i") == 0 || strcmp(*argv, "-o") == 0)
+		{
+			// Takes all following arguments which are neither options
+			// nor commands, so a shell glob can be passed, other files
+			// are given as ./NAME
+			char *option = *argv;
+			int *n_files = option[1] == 'i' ? &n_inputs : &n_outputs;
+			char **files = option[1] == 'i' ? inputs : outputs;
+			int start = *n_files;
+			user_args_t dummy;
+			while (argv[1] && argv[1][0] != '-' && !is_command(argv[1], &dummy))
+				files[(*n_files)++] = *++argv;
+			if (*n_files == start)
+			{
+				fprintf(errs(), "File for %s not given!\n", option);
+				return 0;
+			}
+		}
+		else if (memset(&user_args[arg_i], 0, sizeof(user_args_t)) &&
+				is_command(*argv, &user_args[arg_i]))
+		{
+			if (load_command_user_args(argv, &user_args[arg_i]))
+			{
+				int cmd_num = user_args[arg_i++].cmd_num;
+				// move argv pointer by number of arguments, if it suceeded this
+				// many arguments were already parsed, otherwise it failed and
+				// wont even get here
+				argv += commands_s[cmd_num].no_args;
+				// join can be followed by what to do without a match
+				if (cmd_num == JOIN && argv[1] &&
+						(strcmp(argv[1], "inner") == 0 ||
+						strcmp(argv[1], "left") == 0))
+					user_args[arg_i - 1].num_args[3] =
+						strcmp(*++argv, "left") == 0 ? LEFT_JOIN : INNER_JOIN;
+				// top can be followed by how and in which order to compare
+				if (cmd_num == TOP && argv[1] &&
+						(strcmp(argv[1], "num") == 0 ||
+						strcmp(argv[1], "str") == 0))
+					user_args[arg_i - 1].num_args[2] =
+						strcmp(*++argv, "str") == 0 ? ORDER_STR : ORDER_NUM;
+				if (cmd_num == TOP && argv[1] &&
+						(strcmp(argv[1], "asc") == 0 ||
+						strcmp(argv[1], "desc") == 0))
+					user_args[arg_i - 1].num_args[3] =
+						strcmp(*++argv, "asc") == 0 ? ORDER_ASC : ORDER_DESC;
+				// sample can be followed by the seed of the random generator
+				if (cmd_num == SAMPLE && argv[1] && argv[1][0] >= '0' &&
+						argv[1][0] <= '9' &&
+						!valid_num_arg(*++argv, 1, &user_args[arg_i - 1]))
+					return 0;
+				if (IS_MOD(cmd_num))
+					cmd_types.mod += 1;
+				if (IS_DATA(cmd_num))
+					cmd_types.data += 1;
+				if (IS_SELECTION(cmd_num))
+					cmd_types.selection += 1;
+			}
+			else
+				return 0;
+		}
+		else
+		{
+			fprintf(errs(), "Unexpected argument %s\n", *argv);
+			return 0;
+		}
+	}
+
+	current->user_args = user_args + first;
+	current->arg_no = arg_i - first;
+	current->cmd_types = cmd_types;
+	current->then = NULL;
+	// Spaces padding fixed width columns are not delimiters
+	if (program->fixed_input && !delim_given)
+		program->delim = "\t";
+	for (program_t *p = program; p; p = p->then)
+	{
+		p->delim = program->delim;
+		p->follow = program->follow;
+		p->fixed_input = program->fixed_input;
+		p->fixed_output = program->fixed_output;
+		p->adaptive = program->adaptive;
+		p->level = program->level;
+		if (!row_args_check(p->user_args, p->arg_no))
+			return 0;
+		if (!load_selections(p->user_args, p->arg_no))
+			return 0;
+		for (int i = 0; i < p->arg_no; i++)
+		{
+			int cmd_num = p->user_args[i].cmd_num;
+			if (cmd_num == JOIN && !join_load(p, &p->user_args[i]))
+				return 0;
+			// Taken rows depend on all rows before, which a resumed
+			// program would not see
+			if (IS_FINAL(cmd_num) &&
+					(i != p->arg_no - 1 || program->checkpoint))
+			{
+				fprintf(errs(), "Command %s must be the last one and "
+						"cannot be used with --checkpoint!\n",
+						commands_s[cmd_num].name);
+				return 0;
+			}
+			// A shard neither sees all the rows nor knows the last one
+			if ((program->shards || program->range_end) &&
+					(IS_FINAL(cmd_num) || (cmd_num == ROWS &&
+					p->user_args[i].dash1 && p->user_args[i].dash2)))
+			{
+				fprintf(errs(), "Command %s cannot be used in a shard!\n",
+						commands_s[cmd_num].name);
+				return 0;
+			}
+		}
+		if (p->follow && needs_last_line(p->user_args, p->arg_no))
+		{
+			// A followed input has no last line to wait for
+			fprintf(errs(), "Command rows - - cannot be used with --follow!\n");
+			return 0;
+		}
+	}
+	if ((program->checkpoint || program->resume) &&
+			(n_inputs != 1 || n_outputs != 1 || !program->checkpoint))
+	{
+		// Offsets are only meaningful in a single pair of seekable files
+		fprintf(errs(), "--checkpoint needs one -i and one -o file!\n");
+		return 0;
+	}
+	if (program->follow && (n_outputs > 1 || program->checkpoint))
+	{
+		// Following never ends and offsets start over after a rotation
+		fprintf(errs(), "--follow needs one table and no checkpoint!\n");
+		return 0;
+	}
+	if (program->then && (n_outputs > 1 || program->checkpoint))
+	{
+		// All of the programs have to see the same single table
+		fprintf(errs(), "--then-output needs one table and no checkpoint!\n");
+		return 0;
+	}
+	if ((program->shards || program->range_end || program->first_row) &&
+			(n_inputs != 1 || n_outputs != 1 || program->follow ||
+			program->checkpoint || program->shards == !!program->range_end))
+	{
+		// Sidecar is written next to the output
+		fprintf(errs(), "Expected one of --shard and --byte-range with one "
+				"-i and one -o file!\n");
+		return 0;
+	}
+	if (program->merge && (!n_inputs || n_outputs > 1 || arg_i ||
+				program->then || program->partition_by || program->shards ||
+				program->range_end))
+	{
+		fprintf(errs(), "--merge takes just -i files and one -o file!\n");
+		return 0;
+	}
+	if (!program->partition_by != !program->out_dir)
+	{
+		fprintf(errs(), "--partition-by and --out-dir go together!\n");
+		return 0;
+	}
+	if (program->partition_by && n_outputs)
+	{
+		// Rows are written to the directory instead
+		fprintf(errs(), "--partition-by cannot be used with -o!\n");
+		return 0;
+	}
+	if (n_outputs > 1 && n_outputs != n_inputs)
+	{
+		fprintf(errs(), "Expected one output or one output per input!\n");
+		return 0;
+	}
+	inputs[n_inputs] = outputs[n_outputs] = NULL;
+	for (int i = 0; i < n_inputs; i++)
+		if (!compression_check(inputs[i], program))
+			return 0;
+	for (int i = 0; i < n_outputs; i++)
+		if (!compression_check(outputs[i], program))
+			return 0;
+	for (program_t *p = program->then; p; p = p->then)
+		if (!compression_check(p->then_output, program))
+			return 0;
+
+	program->inputs = inputs;
+	program->outputs = outputs;
+	program->chain = n_inputs > 1 && n_outputs <= 1 ? inputs + 1 : NULL;
+	program->hash = program_hash(program);
+	return 1;
+}
+
+/**
+ * Write outputs of all shards of a table one after another, in the order
+ * of their ranges, after checking by their sidecars that no rows are
+ * missing or repeated
+ * @param char **inputs - outputs of the shards, NULL terminated
+ * @param char *output - file to write, NULL for stdout
+ * @return int - 1 if everything succeeded, 0 if error encountered
+ */
+int merge_shards(char **inputs, char *output)
+{
+	int n = 0, success = 1;
+	while (inputs[n])
+		n++;
+	int shards[n], order[n];
+	long start[n], end[n], first[n], rows[n];
+	char buf[WRITE_BLOCK];
+	FILE *out = stdout;
+
+	for (int i = 0; i < n; i++)
+	{
+		char path[FILENAME_MAX];
+		FILE *file;
+		int loaded;
+		snprintf(path, FILENAME_MAX, "%s.shard", inputs[i]);
+		if (!(file = open_file(path, "r")))
+			return 0;
+		loaded = fscanf(file, "sheet-shard %d %ld %ld %ld %ld", &shards[i],
+				&start[i], &end[i], &first[i], &rows[i]);
+		fclose(file);
+		if (loaded != 5)
+		{
+			fprintf(errs(), "Invalid sidecar %s!\n", path);
+			return 0;
+		}
+		// Insertion sort by start, there are only a few shards
+		int j = i;
+		for (; j && start[order[j - 1]] > start[i]; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+	for (int i = 0; i < n; i++)
+	{
+		int cur = order[i], prev = i ? order[i - 1] : 0;
+		if ((!i && start[cur]) || (i && (start[cur] != end[prev] ||
+				shards[cur] != shards[prev] || (first[cur] && first[prev] &&
+				first[cur] != first[prev] + rows[prev]))) ||
+				(i == n - 1 && shards[cur] && end[cur] != shards[cur]))
+		{
+			fprintf(errs(), "Shard %s does not follow the previous one!\n",
+					inputs[cur]);
+			return 0;
+		}
+	}
+
+	if (output && !(out = open_file(output, "wb")))
+		return 0;
+	for (int i = 0; success && i < n; i++)
+	{
+		FILE *in = open_file(inputs[order[i]], "rb");
+		size_t len;
+		if (!in)
+		{
+			success = 0;
+			break;
+		}
+		while ((len = fread(buf, 1, WRITE_BLOCK, in)))
+			fwrite(buf, 1, len, out);
+		fclose(in);
+	}
+	if (out != stdout && fclose(out) == EOF)
+	{
+		fprintf(errs(), "Cannot write file %s!\n", output);
+		success = 0;
+	}
+	return success;
+}
+
+/**
+ * Free everything load_program allocated for the programs
+ * @param program_t *program - first of the programs loaded by load_program
+ */
+void unload_program(program_t *program)
+{
+	for (; program; program = program->then)
+		for (int i = 0; i < program->arg_no; i++)
+			if (program->user_args[i].table)
+				join_free(program->user_args[i].table);
+}
+
+/**
+ * Run program over table from file input and write it to file output
+ * @param const program_t *program - loaded program
+ * @param char *input - file to read, NULL for stdin
+ * @param char *output - file to write, NULL for stdout
+ * @return int - 1 if everything succeeded, 0 if error encountered
+ */
+int run_files(const program_t *program, char *input, char *output)
+{
+	FILE *in = stdin, *out = stdout;
+	int success;
+
+	if (input && !(in = open_table(input, "rb", program->level)))
+		return 0;
+	// Resumed output keeps what was written before the checkpoint
+	if (output && !(out = open_table(output, program->resume ? "r+b" : "wb",
+					program->level)))
+	{
+		if (in != stdin)
+			fclose(in);
+		return 0;
+	}
+
+	// Output is written by whole blocks instead of being flushed per line
+	setvbuf(out, NULL, _IOFBF, WRITE_BLOCK);
+
+	success = handle_commands(program, in, out);
+	if (in != stdin)
+		fclose(in);
+	if (out != stdout && fclose(out) == EOF)
+	{
+		fprintf(errs(), "Cannot write file %s!\n", output);
+		success = 0;
+	}
+	return success;
+}
+
+// Program compiled by sheet_compile, see sheet.h
+struct sheet
+{
+	program_t *programs;	// loaded programs, the first one is run
+	user_args_t *user_args;	// commands of all of the programs
+	char **inputs;	// always empty, tables are given to sheet_run
+	char **outputs;	// always empty, tables are returned by sheet_run
+	char **args;	// own copy of the arguments, programs point into it
+	int argc;	// amount of arguments, without the name of the program
+};
+
+/**
+ * Collect errors of the calling thread in memory instead of stderr
+ * @param char **text - set to the collected errors, see open_memstream
+ * @param size_t *len - set to the length of text
+ * @return FILE * - stream collecting the errors, NULL if they go to stderr
+ */
+FILE *errors_begin(char **text, size_t *len)
+{
+	return error_stream = open_memstream(text, len);
+}
+
+/**
+ * Stop collecting errors and copy them to the buffer of the caller
+ * @param FILE *errors - stream returned by errors_begin
+ * @param char **text - collected errors, freed
+ * @param char *error - where to store the errors
+ * @param size_t error_size - size of error, longer errors are cut
+ */
+void errors_end(FILE *errors, char **text, char *error, size_t error_size)
+{
+	error_stream = NULL;
+	if (!errors)
+		return;
+	fclose(errors);
+	if (error_size)
+		snprintf(error, error_size, "%s", *text ? *text : "");
+	free(*text);
+}
+
+/**
+ * Compile a program from arguments, see sheet.h
+ */
+SHEET_API sheet_t *sheet_compile(int argc, char **argv, char *error,
+		size_t error_size)
+{
+	char *text = NULL;
+	size_t len = 0;
+	FILE *errors = error ? errors_begin(&text, &len) : NULL;
+	sheet_t *sheet = calloc(1, sizeof(sheet_t));
+	int success = 0;
+	// load_program skips the name of the program and stops at NULL
+	if (!sheet || !(sheet->args = calloc(argc + 2, sizeof(char *))) ||
+			!(sheet->user_args = calloc(argc + 1, sizeof(user_args_t))) ||
+			!(sheet->inputs = calloc(argc + 1, sizeof(char *))) ||
+			!(sheet->outputs = calloc(argc + 1, sizeof(char *))) ||
+			!(sheet->programs = calloc(argc + 1, sizeof(program_t))))
+		fprintf(errs(), "Not enough memory!\n");
+	else
+	{
+		sheet->argc = argc;
+		sheet->args[0] = "sheet";
+		success = 1;
+		for (int i = 0; success && i < argc; i++)
+			success = (sheet->args[i + 1] = strdup(argv[i])) != NULL;
+		if (!success)
+			fprintf(errs(), "Not enough memory!\n");
+		else
+			success = load_program(sheet->args, sheet->user_args,
+					sheet->inputs, sheet->outputs, sheet->programs);
+		if (success && (sheet->inputs[0] || sheet->outputs[0]))
+		{
+			fprintf(errs(), "Tables are given in memory, -i and -o cannot "
+					"be used!\n");
+			success = 0;
+		}
+	}
+	errors_end(errors, &text, error, error_size);
+	if (success)
+		return sheet;
+	sheet_free(sheet);
+	return NULL;
+}
+
+/**
+ * Run a compiled program over a table in memory, see sheet.h
+ */
+SHEET_API int sheet_run(const sheet_t *sheet, const char *in, size_t in_len,
+		char **out, size_t *out_len, char *error, size_t error_size)
+{
+	char *text = NULL;
+	size_t len = 0;
+	FILE *errors = error ? errors_begin(&text, &len) : NULL;
+	FILE *table = fmemopen(in_len ? (char *) in : "", in_len, "r");
+	FILE *result = open_memstream(out, out_len);
+	int success = table && result;
+	if (!success)
+		fprintf(errs(), "Not enough memory!\n");
+	else
+		success = handle_commands(sheet->programs, table, result);
+	if (table)
+		fclose(table);
+	if (result && fclose(result) == EOF)
+		success = 0;
+	if (!result)
+	{
+		*out = NULL;
+		*out_len = 0;
+	}
+	errors_end(errors, &text, error, error_size);
+	return success;
+}
+
+/**
+ * Free a compiled program, see sheet.h
+ */
+SHEET_API void sheet_free(sheet_t *sheet)
+{
+	if (!sheet)
+		return;
+	// Also frees tables of a program which failed to load
+	for (int i = 0; sheet->user_args && i < sheet->argc; i++)
+		if (sheet->user_args[i].table)
+			join_free(sheet->user_args[i].table);
+	for (int i = 1; sheet->args && i <= sheet->argc; i++)
+		free(sheet->args[i]);
+	free(sheet->args);
+	free(sheet->user_args);
+	free(sheet->inputs);
+	free(sheet->outputs);
+	free(sheet->programs);
+	free(sheet);
+}
+
+// SHEET_NO_MAIN leaves out main, for make lib and for microbench.c, which
+// includes this file to reach its internals
+#ifndef SHEET_NO_MAIN
+// Program compiled by a server, shared by the workers running it
+typedef struct cached
+{
+	char *key;	// part of the request with the arguments of the program
+	size_t key_len;	// length of key
+	unsigned hash;	// hash of key
+	sheet_t *sheet;	// compiled program
+	int users;	// amount of workers running the program
+	int evicted;	// 1 once dropped from the cache, freed by its last user
+	// Neighbours in the cache, most recently used first
+	struct cached *prev;
+	struct cached *next;
+} cached_t;
+
+// State shared by all workers of a server
+typedef struct server
+{
+	int fd;	// listening socket
+	pthread_mutex_t lock;	// guards the cache
+	cached_t *head;	// most recently used program
+	cached_t *tail;	// least recently used program
+	int n_cached;	// amount of cached programs
+} server_t;
+
+/**
+ * Read everything from fd until the other side stops writing
+ * @param int fd - socket or file to read
+ * @param char **buf - set to the read chars allocated by malloc, followed
+ * by '\0' which is not counted
+ * @param size_t *len - set to the amount of read chars
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int read_all(int fd, char **buf, size_t *len)
+{
+	size_t size = SERVE_BLOCK;
+	ssize_t got;
+	*len = 0;
+	if (!(*buf = malloc(size + 1)))
+		return 0;
+	while ((got = read(fd, *buf + *len, size - *len)) > 0)
+	{
+		char *bigger;
+		if ((*len += got) < size)
+			continue;
+		if (!(bigger = realloc(*buf, size * 2 + 1)))
+		{
+			free(*buf);
+			return 0;
+		}
+		*buf = bigger;
+		size *= 2;
+	}
+	(*buf)[*len] = '\0';
+	return !got;
+}
+
+/**
+ * Write len chars of buf to a socket, a closed socket is an error instead
+ * of a signal
+ * @param int fd - connected socket
+ * @param const char *buf - chars to write
+ * @param size_t len - amount of chars
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+int write_all(int fd, const char *buf, size_t len)
+{
+	while (len)
+	{
+		ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL);
+		if (sent < 0)
+			return 0;
+		buf += sent;
+		len -= sent;
+	}
+	return 1;
+}
+
+/**
+ * Drop the least recently used program from the cache, it is freed once
+ * no worker runs it
+ * @param server_t *server - server with a full cache, locked
+ */
+void server_evict(server_t *server)
+{
+	cached_t *c = server->tail;
+	server->tail = c->prev;
+	if (c->prev)
+		c->prev->next = NULL;
+	else
+		server->head = NULL;
+	server->n_cached--;
+	c->evicted = 1;
+	if (c->users)
+		return;
+	sheet_free(c->sheet);
+	free(c->key);
+	free(c);
+}
+
+/**
+ * Return cached program of the arguments of key and make it the most
+ * recently used one, the caller becomes one of its users
+ * @param server_t *server - server with the cache, locked
+ * @param char *key - part of the request with the arguments
+ * @param size_t key_len - length of key
+ * @param unsigned hash - hash of key
+ * @return cached_t * - cached program, NULL if not cached
+ */
+cached_t *server_find(server_t *server, char *key, size_t key_len,
+		unsigned hash)
+{
+	cached_t *c = server->head;
+	// The cache is small, so a scan is as fast as any lookup
+	while (c && (c->hash != hash || c->key_len != key_len ||
+				memcmp(c->key, key, key_len)))
+		c = c->next;
+	if (!c)
+		return NULL;
+	if (c != server->head)
+	{
+		c->prev->next = c->next;
+		if (c->next)
+			c->next->prev = c->prev;
+		else
+			server->tail = c->prev;
+		c->prev = NULL;
+		c->next = server->head;
+		server->head->prev = c;
+		server->head = c;
+	}
+	c->users++;
+	return c;
+}
+
+/**
+ * Return program compiled from arguments, compiling and caching it unless
+ * it is already cached, the caller becomes one of its users
+ * @param server_t *server - server with the cache
+ * @param char *key - part of the request with the arguments
+ * @param size_t key_len - length of key
+ * @param int argc - amount of arguments
+ * @param char **argv - arguments, pointing into key
+ * @param char *error - where to store errors, SERVE_ERROR long
+ * @return cached_t * - program to run, NULL if error encountered
+ */
+cached_t *server_program(server_t *server, char *key, size_t key_len,
+		int argc, char **argv, char *error)
+{
+	unsigned hash = hash_bytes(2166136261u, key, key_len);
+	cached_t *c, *found;
+	pthread_mutex_lock(&server->lock);
+	c = server_find(server, key, key_len, hash);
+	pthread_mutex_unlock(&server->lock);
+	if (c)
+		return c;
+
+	// Compiling may load join tables, so other workers are not held back
+	if (!(c = calloc(1, sizeof(cached_t))) || !(c->key = malloc(key_len)))
+	{
+		snprintf(error, SERVE_ERROR, "Not enough memory!\n");
+		free(c);
+		return NULL;
+	}
+	if (!(c->sheet = sheet_compile(argc, argv, error, SERVE_ERROR)))
+	{
+		free(c->key);
+		free(c);
+		return NULL;
+	}
+	memcpy(c->key, key, key_len);
+	c->key_len = key_len;
+	c->hash = hash;
+	c->users = 1;
+
+	pthread_mutex_lock(&server->lock);
+	// Another worker may have compiled the same program meanwhile
+	if ((found = server_find(server, key, key_len, hash)))
+	{
+		pthread_mutex_unlock(&server->lock);
+		sheet_free(c->sheet);
+		free(c->key);
+		free(c);
+		return found;
+	}
+	if (server->n_cached == SERVE_CACHE)
+		server_evict(server);
+	c->next = server->head;
+	if (server->head)
+		server->head->prev = c;
+	else
+		server->tail = c;
+	server->head = c;
+	server->n_cached++;
+	pthread_mutex_unlock(&server->lock);
+	return c;
+}
+
+/**
+ * Stop using a program returned by server_program
+ * @param server_t *server - server with the cache
+ * @param cached_t *c - program which is no longer run
+ */
+void server_release(server_t *server, cached_t *c)
+{
+	int gone;
+	pthread_mutex_lock(&server->lock);
+	gone = !--c->users && c->evicted;
+	pthread_mutex_unlock(&server->lock);
+	if (!gone)
+		return;
+	sheet_free(c->sheet);
+	free(c->key);
+	free(c);
+}
+
+/**
+ * Answer a single request of a client. A request is the amount of
+ * arguments and '\n', the arguments each ended by '\0' and the table.
+ * The answer is "SUCCESS OUT_LEN ERROR_LEN\n", the resulting table and
+ * the error messages
+ * @param server_t *server - server with the cache
+ * @param int fd - socket connected to the client
+ */
+void serve_request(server_t *server, int fd)
+{
+	char *request, *pos, *end, **argv = NULL, *out = NULL;
+	char error[SERVE_ERROR] = "", header[64];
+	size_t len, out_len = 0;
+	long argc;
+	int success = 0;
+	cached_t *c;
+
+	if (!read_all(fd, &request, &len))
+	{
+		fprintf(errs(), "Cannot read request!\n");
+		return;
+	}
+	end = request + len;
+	argc = strtol(request, &pos, 10);
+	if (pos == request || *pos != '\n' || argc < 0 || argc > end - pos ||
+			!(argv = malloc((argc + 1) * sizeof(char *))))
+		snprintf(error, SERVE_ERROR, "Malformed request!\n");
+	else
+	{
+		pos++;
+		for (long i = 0; i < argc && pos; i++)
+		{
+			argv[i] = pos;
+			pos = memchr(pos, '\0', end - pos);
+			pos = pos ? pos + 1 : NULL;
+		}
+		if (!pos)
+			snprintf(error, SERVE_ERROR, "Malformed request!\n");
+		else if ((c = server_program(server, request, pos - request, argc,
+						argv, error)))
+		{
+			success = sheet_run(c->sheet, pos, end - pos, &out, &out_len,
+					error, SERVE_ERROR);
+			server_release(server, c);
+		}
+	}
+	snprintf(header, sizeof(header), "%d %zu %zu\n", success, out_len,
+			strlen(error));
+	// A client which went away only loses its answer
+	if (write_all(fd, header, strlen(header)) &&
+			write_all(fd, out, out_len))
+		write_all(fd, error, strlen(error));
+	free(out);
+	free(argv);
+	free(request);
+}
+
+/**
+ * Answer clients connecting to the server one after another
+ * @param void *arg - server_t of the server
+ * @return void * - NULL
+ */
+void *serve_worker(void *arg)
+{
+	server_t *server = arg;
+	for (;;)
+	{
+		int fd = accept(server->fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+		serve_request(server, fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+/**
+ * Fill address of a unix socket at path
+ * @param struct sockaddr_un *addr - address to fill
+ * @param char *path - path of the socket
+ * @return int - 1 if succeeded, 0 if path is too long
+ */
+int socket_address(struct sockaddr_un *addr, char *path)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path))
+	{
+		fprintf(errs(), "Socket path %s is too long!\n", path);
+		return 0;
+	}
+	strcpy(addr->sun_path, path);
+	return 1;
+}
+
+/**
+ * Serve requests of clients on a unix socket with a worker per processor,
+ * compiled programs are cached, so repeated commands are not loaded again
+ * @param char *path - path of the socket
+ * @return int - 0 if error encountered, never returns otherwise
+ */
+int serve(char *path)
+{
+	server_t server = { -1, PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0 };
+	struct sockaddr_un addr;
+	long n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	int probe;
+	pthread_t worker;
+
+	if (!socket_address(&addr, path))
+		return 0;
+	// A socket nobody listens on is left over by a server which ended
+	if ((probe = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0)
+	{
+		if (!connect(probe, (struct sockaddr *) &addr, sizeof(addr)))
+		{
+			fprintf(errs(), "Socket %s is already served!\n", path);
+			close(probe);
+			return 0;
+		}
+		close(probe);
+		unlink(path);
+	}
+	if ((server.fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+			bind(server.fd, (struct sockaddr *) &addr, sizeof(addr)) ||
+			listen(server.fd, SOMAXCONN))
+	{
+		fprintf(errs(), "Cannot listen on socket %s!\n", path);
+		return 0;
+	}
+	for (long i = 1; i < n_workers; i++)
+		if (pthread_create(&worker, NULL, serve_worker, &server))
+		{
+			fprintf(errs(), "Cannot start a worker!\n");
+			return 0;
+		}
+	serve_worker(&server);
+	return 0;
+}
+
+/**
+ * Run commands on a server instead of loading them, the table is read from
+ * stdin and the result written to stdout
+ * @param char *path - path of the socket of the server
+ * @param int argc - amount of arguments
+ * @param char **argv - arguments as the command line would take them
+ * @return int - 1 if everything succeeded, 0 if error encountered
+ */
+int client(char *path, int argc, char **argv)
+{
+	struct sockaddr_un addr;
+	char block[SERVE_BLOCK], *answer, *pos;
+	size_t len, out_len, error_len;
+	ssize_t got;
+	int fd, success;
+
+	if (!socket_address(&addr, path))
+		return 0;
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+			connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+	{
+		fprintf(errs(), "Cannot connect to socket %s!\n", path);
+		return 0;
+	}
+	snprintf(block, sizeof(block), "%d\n", argc);
+	success = write_all(fd, block, strlen(block));
+	for (int i = 0; success && i < argc; i++)
+		success = write_all(fd, argv[i], strlen(argv[i]) + 1);
+	// The table is passed on by blocks as it is read
+	while (success && (got = read(STDIN_FILENO, block, sizeof(block))) > 0)
+		success = write_all(fd, block, got);
+	if (!success || shutdown(fd, SHUT_WR) || !read_all(fd, &answer, &len))
+	{
+		fprintf(errs(), "Cannot talk to the server!\n");
+		close(fd);
+		return 0;
+	}
+	close(fd);
+	if (sscanf(answer, "%d %zu %zu", &success, &out_len, &error_len) != 3 ||
+			!(pos = memchr(answer, '\n', len)) ||
+			(size_t) (answer + len - pos - 1) != out_len + error_len)
+	{
+		fprintf(errs(), "Malformed answer of the server!\n");
+		free(answer);
+		return 0;
+	}
+	fwrite(pos + 1, 1, out_len, stdout);
+	fwrite(pos + 1 + out_len, 1, error_len, errs());
+	free(answer);
+	return success && !ferror(stdout);
+}
+
+int main(int argc, char **argv)
+{
+	user_args_t user_args[argc];
+	char *inputs[argc], *outputs[argc];
+	program_t programs[argc], *program = programs;
+	int success = 1;
+
+	// Server and client modes take the socket and nothing else
+	if (argc == 3 && strcmp(argv[1], "--serve") == 0)
+		return serve(argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (argc >= 3 && strcmp(argv[1], "--client") == 0)
+		return client(argv[2], argc - 3, argv + 3) ? EXIT_SUCCESS :
+			EXIT_FAILURE;
+	if (!load_program(argv, user_args, inputs, outputs, programs))
+		return EXIT_FAILURE;
+
+	if (program->merge)
+		success = merge_shards(inputs, outputs[0]);
+	else if (outputs[0] && outputs[1])
+	{
+		// Every input is a table of its own with its own output
+		for (int i = 0; success && inputs[i]; i++)
+			success = run_files(program, inputs[i], outputs[i]);
+	}
+	else
+		success = run_files(program, inputs[0], outputs[0]);
+	unload_program(program);
+
+	if(!success)
 		return EXIT_FAILURE;
 	else
 		return EXIT_SUCCESS;
 }
+#endif
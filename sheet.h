@@ -0,0 +1,59 @@
+/**
+ * @File sheet.h
+ * @Brief Interface of libsheet, the table editor run over tables in memory
+ * A program is compiled once from the same arguments the command line takes
+ * and then run over any number of tables, even from more threads at once.
+ * Tables are given and returned as buffers, errors are returned as text
+ * The file was written using hard tabs and intended for swiftwidth of 4 and
+ * line limit of 80
+ */
+#ifndef SHEET_H
+#define SHEET_H
+
+#include <stddef.h>
+
+// Only the functions below are exported by make lib
+#ifdef __GNUC__
+#define SHEET_API __attribute__((visibility("default")))
+#else
+#define SHEET_API
+#endif
+
+// Compiled program, never modified once compiled
+typedef struct sheet sheet_t;
+
+/**
+ * Compile commands and options given as on the command line, except for -i
+ * and -o, since the tables are given to sheet_run
+ * @param int argc - amount of arguments
+ * @param char **argv - arguments without the name of the program, e.g.
+ * { "-d", ":", "toupper", "1" }, they are copied
+ * @param char *error - where to store error messages, NULL for stderr
+ * @param size_t error_size - size of error, longer messages are cut
+ * @return sheet_t * - compiled program, NULL if error encountered
+ */
+SHEET_API sheet_t *sheet_compile(int argc, char **argv, char *error,
+		size_t error_size);
+
+/**
+ * Run a compiled program over a table
+ * @param const sheet_t *sheet - compiled program
+ * @param const char *in - the table, NULL if in_len is 0
+ * @param size_t in_len - length of the table
+ * @param char **out - set to the resulting table allocated by malloc, it
+ * is to be freed even if error is encountered
+ * @param size_t *out_len - set to the length of the resulting table
+ * @param char *error - where to store error messages, NULL for stderr
+ * @param size_t error_size - size of error, longer messages are cut
+ * @return int - 1 if succeeded, 0 if error encountered
+ */
+SHEET_API int sheet_run(const sheet_t *sheet, const char *in, size_t in_len,
+		char **out, size_t *out_len, char *error, size_t error_size);
+
+/**
+ * Free a compiled program, no sheet_run may be running it
+ * @param sheet_t *sheet - program to free, may be NULL
+ */
+SHEET_API void sheet_free(sheet_t *sheet);
+
+#endif